@@ -18,7 +18,39 @@
 #ifndef ALU_H
 #define ALU_H
 
+#include <stdint.h>
+
 #include "archdefs.h"
+#include "register.h"
+
+/* Pending flag evaluation */
+#define ALU_FLAGS_NONE		0
+#define ALU_FLAGS_ADD_SIGNED	1
+#define ALU_FLAGS_ADD_UNSIGNED	2
+#define ALU_FLAGS_SUB_SIGNED	3
+#define ALU_FLAGS_SUB_UNSIGNED	4
+#define ALU_FLAGS_MUL_SIGNED	5
+#define ALU_FLAGS_MUL_UNSIGNED	6
+
+/* Data Structures */
+struct alu_flags {
+	uint8_t op;		/* Operation whose OF/UF are pending */
+	uint8_t size;		/* Operand width, in bytes */
+	leg_ull_t from;		/* Source operand */
+	leg_ull_t to;		/* Target operand */
+};
+
+struct alu_cache {
+	leg_addr_t rarth;	/* RARTH value (without OF/UF) of the kernels */
+	int (*arth) (volatile void *, volatile void *);		/* Integer kernel */
+	int (*arth_fp) (volatile void *, volatile void *);	/* RFP kernel */
+	leg_addr_t rlgic;	/* RLGIC value of the kernel */
+	int (*lgic) (volatile void *, volatile void *);		/* Logic kernel */
+};
+
+/* External variables */
+extern struct alu_flags alu_flags;
+extern struct alu_cache alu_cache;
 
 /* Macros */
 #define alu_add_signed_eval_uf_of(type)	(regs.rarth |= (to > 0 ? to : -to) > ((((type) ~0) >> 1) - (from > 0 ? from : -from)) ? ((to < 0) && (from < 0) ? REG_ARTH_BIT_UF : REG_ARTH_BIT_OF) : 0)
@@ -28,6 +60,14 @@
 #define alu_mul_signed_eval_uf_of(type) (regs.rarth |= to ? (((((type) ~0) >> 1) / to) > from ? REG_ARTH_BIT_OF : (from < 0) || (to < 0) ? REG_ARTH_BIT_UF : 0) : 0)
 #define alu_mul_unsigned_eval_uf_of(type) (regs.rarth |= to ? ((((type) ~0) / to) > from ? REG_ARTH_BIT_OF : 0) : 0)
 
+/* Record the operation so OF/UF are only evaluated when RARTH is read */
+#define alu_add_signed_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_ADD_SIGNED, sizeof(type), from, to)
+#define alu_add_unsigned_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_ADD_UNSIGNED, sizeof(type), from, to)
+#define alu_sub_signed_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_SUB_SIGNED, sizeof(type), from, to)
+#define alu_sub_unsigned_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_SUB_UNSIGNED, sizeof(type), from, to)
+#define alu_mul_signed_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_MUL_SIGNED, sizeof(type), from, to)
+#define alu_mul_unsigned_defer_uf_of(type) alu_flags_defer(ALU_FLAGS_MUL_UNSIGNED, sizeof(type), from, to)
+
 /* Prototypes */
 // Arithmetic
 leg_char_t alu_add_char(leg_char_t, leg_char_t);
@@ -115,5 +155,52 @@ leg_ushort_t alu_ror_ushort(leg_ushort_t from, leg_ushort_t to);
 leg_uint_t alu_ror_uint(leg_uint_t from, leg_uint_t to);
 leg_ulong_t alu_ror_ulong(leg_ulong_t from, leg_ulong_t to);
 
+// Kernel resolution
+void alu_arth_resolve(void);
+void alu_lgic_resolve(void);
+
+// Flags
+void alu_flags_eval(void);
+
+/* Inline routines */
+static inline void alu_flags_defer(uint8_t op, uint8_t size, leg_ull_t from, leg_ull_t to) {
+	/* Materialize the flags of a previous operation still pending */
+	if (alu_flags.op)
+		alu_flags_eval();
+
+	alu_flags.op = op;
+	alu_flags.size = size;
+	alu_flags.from = from;
+	alu_flags.to = to;
+}
+
+/* Must be called before RARTH is read or saved */
+static inline void alu_flags_sync(void) {
+	if (alu_flags.op)
+		alu_flags_eval();
+}
+
+/* Drop any pending flags and clear OF/UF on RARTH */
+static inline void alu_flags_clear(void) {
+	alu_flags.op = ALU_FLAGS_NONE;
+	regs.rarth &= ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF);
+}
+
+static inline int alu_arth(volatile void *from, volatile void *to, int fp) {
+	/* Resolve the kernels again only if RARTH was written */
+	if ((regs.rarth & ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF)) != alu_cache.rarth)
+		alu_arth_resolve();
+
+	return fp ? alu_cache.arth_fp(from, to) : alu_cache.arth(from, to);
+}
+
+static inline int alu_lgic(volatile void *from, volatile void *to) {
+	/* Resolve the kernel again only if RLGIC was written */
+	if (regs.rlgic != alu_cache.rlgic)
+		alu_lgic_resolve();
+
+	return alu_cache.lgic(from, to);
+}
+
 #endif
 
@@ -0,0 +1,87 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "archdefs.h"
+
+/* Cache files are stored at <vm dir>/AOT_DIR/<image hash>AOT_SUFFIX */
+#define AOT_DIR			"aot"
+#define AOT_SUFFIX		".aot"
+#define AOT_IMAGES_MAX		8	/* Images loaded per VM */
+
+/* File format. All fields are stored in network byte order. */
+#define AOT_MAGIC		0x4C414F54	/* "LAOT" */
+#define AOT_VERSION		1
+
+#define AOT_ENTRY_BRANCH	0x01	/* Literal jmp/call, a basic block starts at target */
+
+struct aot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t stor_id;	/* Storage holding the image */
+	uint32_t stor_offset;	/* Image offset on storage */
+	uint32_t size;		/* Image size in bytes */
+	uint32_t hash_hi;	/* FNV-1a hash of the image contents */
+	uint32_t hash_lo;
+	uint32_t count;		/* Number of entries that follow */
+};
+
+struct aot_entry {
+	uint32_t offset;	/* Instruction offset in the image */
+	uint32_t flags;		/* AOT_ENTRY_* */
+	uint32_t target;	/* Branch target address, if AOT_ENTRY_BRANCH is set */
+};
+
+/* Data structures */
+struct aot_image {
+	struct aot_header hdr;	/* Host byte order */
+	struct aot_entry *entry; /* Host byte order */
+};
+
+struct aot {
+	struct aot_image image[AOT_IMAGES_MAX];
+	unsigned int count;
+};
+
+/* External variables */
+extern struct aot aot;
+
+/* Prototypes */
+int aot_init(const char *);
+void aot_load(uint16_t, uint64_t, leg_addr_t, leg_addr_t);
+void aot_share(uint16_t, uint64_t, leg_addr_t, leg_addr_t);
+void aot_destroy(void);
+
+/* Inline routines */
+static inline uint64_t aot_hash(const uint8_t *data, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	while (size--) {
+		hash ^= *data++;
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+#endif
+
@@ -97,6 +97,7 @@
  * |  2	 | Task Registers Disabled	| Task Registers Enabled	|
  * |  3	 | Privilege Level 0		| Privilege Level 1		|
  * |  4	 | Paging Disabled		| Paging Enabled		|
+ * |  5	 | Page List Format		| Radix Page Table Format	|
  * +-----+------------------------------+-------------------------------+
  *
  */
@@ -105,6 +106,7 @@
 #define REG_RST_BIT_TSK		0x04	/* Set to enable task registers */
 #define REG_RST_BIT_LOWPRIV	0x08	/* Set to drop privilege level to 1 */
 #define REG_RST_BIT_PAGING	0x10	/* Set to enable paging */
+#define REG_RST_BIT_RADIX	0x20	/* Set to use radix page tables */
 
 /* Comparator register */
 #define REG_RCMP_BIT_RESULT	0x01
@@ -183,6 +185,16 @@
 
 /* Memory management */
 #define MM_PAGING_SUPPORT	1
+#define MM_GUARD_REGION_SUPPORT	1	/* Trap accesses past RAM (needs 64-bit host) */
+#define MM_WATCH_SUPPORT	1	/* Data watchpoints (needs x86-64 Linux host) */
+#define MM_DIRTY_SUPPORT	1	/* Dirty RAM tracking (needs Linux host) */
+
+/* Execution cores */
+#define RUN_THREADED_SUPPORT	1	/* Threaded core (needs GCC/Clang) */
+#define RUN_JIT_SUPPORT		1	/* x86-64 JIT core (needs GCC/Clang) */
+
+/* Storage I/O */
+#define IO_URING_SUPPORT	1	/* Asynchronous storage I/O through io_uring (needs Linux host) */
 
 /* Interrupts */
 #define INTR_01			0x01	/* Interrupt vector customization
@@ -204,10 +216,13 @@
 					 *	  0x01 - Read
 					 *	  0x02 - Write
 					 *	  0x04 - Extended Offset
+					 *	  0x08 - Asynchronous, completes
+					 *	         through INTR_12
 					 * rgp2: Storage Data Offset
 					 * rgp3: Storage Data Size
 					 * rgp4: Data Buffer Memory Address
 					 * rgp5: Extended Data Offset (H32-bit)
+					 * rgp6: Request Tag (Asynchronous)
 					 */
 #define INTR_0D			0x0D	/* Page cache invalidation
 					 * rgp1: Base Physical Address
@@ -218,6 +233,52 @@
 					 * rgp3: Time to Expire
 					 */
 #define INTR_10			0x10	/* Timer expired interrupt */
+#define INTR_11			0x11	/* Memory balloon interrupt
+					 * rgp1: Flags
+					 * 	Flags:
+					 *	  0x01 - Inflate, return RAM to host
+					 *	  0x02 - Deflate, reclaim RAM
+					 * rgp2: Base Physical Address
+					 * rgp3: Size
+					 * Sets rgp1 to the bytes held by the
+					 * balloon. Inflated RAM reads as zero
+					 * or as the image it was loaded from.
+					 */
+#define INTR_12			0x12	/* Storage I/O completion interrupt
+					 * Sets rgp1 to the Request Tag and
+					 * rgp2 to 0 on success, 1 on failure.
+					 */
+#define INTR_13			0x13	/* Storage descriptor queue doorbell
+					 * rgp1: Descriptors Base Physical Address
+					 * rgp2: Number of Descriptors
+					 * Sets rgp1 to the number of failed
+					 * descriptors.
+					 * Descriptor layout (big-endian):
+					 *   0x00: Storage ID and INTR_0B Flags
+					 *         (Read or Write)
+					 *   0x04: Storage Data Offset (H32-bit)
+					 *   0x08: Storage Data Offset (L32-bit)
+					 *   0x0C: Storage Data Size
+					 *   0x10: Data Buffer Physical Address
+					 *   0x14: Status, set to 0 on success,
+					 *         1 on failure
+					 */
+#define INTR_14			0x14	/* Storage window interrupt
+					 * rgp1 & 0xFFFF: Storage ID
+					 * rgp1 & 0xFFFF0000: Flags
+					 * 	Flags:
+					 *	  0x01 - Map
+					 *	  0x02 - Unmap
+					 *	  0x04 - Extended Offset
+					 *	  0x08 - Sync
+					 * rgp2: Storage Data Offset
+					 * rgp3: Window Size
+					 * rgp4: Window Base Physical Address
+					 * rgp5: Extended Data Offset (H32-bit)
+					 * Offset, size and address shall be
+					 * aligned to host pages.
+					 */
+#define INTR_15			0x15	/* Storage cache flush interrupt */
 
 /* Instruction set */
 #define INSTRUCTION_SET_SIZE	14
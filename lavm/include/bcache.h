@@ -0,0 +1,72 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "archdefs.h"
+
+/* Storage blocks are cached in front of the storage files, so small
+ * accesses don't cost a host call each. Stores are written back on
+ * eviction, on INTR_15 and when the VM exits.
+ */
+#define BCACHE_BLOCK_SIZE	4096	/* Default block size */
+#define BCACHE_BYPASS_BLOCKS	16	/* Larger requests go straight to storage */
+
+/* Data structures */
+struct bcache_block {
+	uint64_t index;			/* Block number on storage */
+	uint16_t storid;
+	uint8_t valid;
+	uint8_t dirty;
+	uint8_t ref;			/* Accessed since the clock hand passed */
+	size_t len;			/* Bytes backed by storage, less at EOF */
+	struct bcache_block *next;	/* Hash chain */
+};
+
+struct bcache {
+	struct bcache_block *block;
+	struct bcache_block **hash;
+	uint8_t *data;
+	size_t count;			/* Blocks, 0 if disabled */
+	size_t size;			/* Bytes per block */
+	size_t hash_mask;
+	size_t hand;			/* Clock hand */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t writebacks;
+};
+
+/* External variables */
+extern struct bcache bcache;
+
+/* Prototypes */
+int bcache_init(void);
+ssize_t bcache_read(uint16_t, void *, size_t, uint64_t);
+ssize_t bcache_write(uint16_t, const void *, size_t, uint64_t);
+int bcache_sync(uint16_t, uint64_t, size_t, int);
+int bcache_flush(void);
+void bcache_stats(void);
+void bcache_destroy(void);
+
+#endif
+
@@ -26,10 +26,26 @@
 #define PQ_IPC_KEY	1234
 #define PQ_MSG_SZ	1024
 
+#define CONFIG_WATCH_MAX	16	/* Watchpoints per VM */
+
 /* Data structures */
+struct config_watch {
+	leg_addr_t addr;		/* Physical address */
+	leg_addr_t size;		/* Bytes watched */
+	uint8_t pause;			/* Stop the VM on hits instead of logging only */
+};
+
 struct config_vm {
 	leg_addr_t ram;			/* System RAM */
 	char *stor[HW_STOR_MAX];	/* Storage */
+	uint8_t core;			/* Execution core (optional) */
+	uint8_t mm;			/* MM_OPT_* RAM options (optional) */
+	leg_addr_t dirty;		/* Dirty tracking granularity, 0 for host pages */
+	char *share;			/* Directory of images shared between VMs (optional) */
+	unsigned int cache;		/* Storage block cache size in blocks (optional) */
+	unsigned int cache_block;	/* Storage block cache block size, 0 for default */
+	struct config_watch watch[CONFIG_WATCH_MAX];	/* Watchpoints (optional) */
+	unsigned int watch_count;
 };
 
 struct config {
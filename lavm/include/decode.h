@@ -0,0 +1,91 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+#include "archdefs.h"
+
+/* Decoded instruction cache geometry */
+#define DECODE_CACHE_SIZE	4096	/* Number of entries (power of 2) */
+#define DECODE_BLOCK_SHIFT	8	/* Code map granularity (256 bytes) */
+#define DECODE_INSN_MAX		(3 * (ARCH_ADDR_BITS >> 3)) /* Largest insn */
+#define DECODE_SPAN_MAX		(7 * (ARCH_ADDR_BITS >> 3)) /* Largest fused group */
+#define DECODE_LOOP_REGS	7	/* Register slots of a loop idiom */
+
+/* Data Structures */
+struct decode {
+	leg_addr_t paddr;	/* Physical address of the instruction */
+	uint32_t opcode;	/* Raw opcode, host byte order */
+	leg_addr_t oper1;	/* First operand, host byte order */
+	leg_addr_t oper2;	/* Second operand, host byte order */
+	uint8_t size;		/* Instruction size in bytes, 0 if unused */
+	uint8_t id;		/* Instruction ID */
+	uint8_t oper1_type;	/* First operand type */
+	uint8_t oper2_type;	/* Second operand type */
+	uint8_t variant;	/* Handler index in instruction_dispatch */
+	uint8_t fused;		/* Superinstruction index, 0 if not fused */
+	uint8_t span;		/* Bytes covered, including fused instructions */
+	leg_addr_t fuse_oper[3]; /* Operands of the fused instructions */
+	uint8_t loop_reg[DECODE_LOOP_REGS]; /* Registers of a loop idiom */
+	const void *thread;	/* Threaded core handler label */
+};
+
+struct decode_cache {
+	struct decode entry[DECODE_CACHE_SIZE];
+	uint8_t *map;		/* One bit per code block holding cached insns */
+	leg_addr_t map_blocks;	/* Number of blocks covered by the map */
+};
+
+/* External variables */
+extern struct decode_cache dcache;
+
+/* Macros */
+#define decode_map_test(addr) (((addr) >> DECODE_BLOCK_SHIFT) < dcache.map_blocks && (dcache.map[(addr) >> (DECODE_BLOCK_SHIFT + 3)] & (1 << (((addr) >> DECODE_BLOCK_SHIFT) & 7))))
+
+/* Prototypes */
+struct decode *decode_fetch(leg_addr_t);
+int decode_prefetch(leg_addr_t);
+int decode_peek(leg_addr_t, struct decode *);
+void decode_track(leg_addr_t, leg_addr_t);
+void decode_invalidate(leg_addr_t, leg_addr_t);
+void decode_flush(void);
+int decode_init(void);
+void decode_destroy(void);
+
+/* Inline routines */
+static inline struct decode *decode_lookup(leg_addr_t paddr) {
+	struct decode *d = &dcache.entry[(paddr >> 2) & (DECODE_CACHE_SIZE - 1)];
+
+	return ((d->paddr == paddr) && d->size) ? d : NULL;
+}
+
+/* Must be called whenever guest memory is written by an instruction.
+ * Only suitable for writes smaller than a code block; larger writes shall
+ * call decode_invalidate() directly.
+ */
+static inline void decode_write(leg_addr_t addr, leg_addr_t size) {
+	leg_addr_t start = addr > DECODE_SPAN_MAX ? addr - (DECODE_SPAN_MAX - 1) : 0;
+
+	if (decode_map_test(start) || decode_map_test(addr + size - 1))
+		decode_invalidate(addr, size);
+}
+
+#endif
+
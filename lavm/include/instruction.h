@@ -45,8 +45,72 @@ void ceb(leg_addr_t, leg_addr_t, uint8_t, uint8_t, uint8_t);
 void nop(leg_addr_t, leg_addr_t, uint8_t, uint8_t, uint8_t);
 void ltsk(leg_addr_t, leg_addr_t, uint8_t, uint8_t, uint8_t);
 
+/* Execution modes, selected from RST paging and privilege bits */
+#define INSTRUCTION_MODE_PAGING		0x01
+#define INSTRUCTION_MODE_LOWPRIV	0x02
+#define INSTRUCTION_MODE_DYNAMIC	0x80	/* Evaluate RST at runtime */
+#define INSTRUCTION_MODES		4
+
+/* Operand kind specialized handlers: X(id, handler, suffix, type1, type2) */
+#define INSTRUCTION_VARIANTS(X) \
+	X(0x01, cpvr, rr, REG, REG) \
+	X(0x01, cpvr, rl, REG, LIT) \
+	X(0x02, cpvl, lr, LIT, REG) \
+	X(0x02, cpvl, ll, LIT, LIT) \
+	X(0x03, cpr, rr, REG, REG) \
+	X(0x03, cpr, rl, REG, LIT) \
+	X(0x03, cpr, lr, LIT, REG) \
+	X(0x03, cpr, ll, LIT, LIT) \
+	X(0x04, cprr, rr, REG, REG) \
+	X(0x05, cmp, rr, REG, REG) \
+	X(0x07, call, lr, LIT, REG) \
+	X(0x08, ret, rr, REG, REG) \
+	X(0x09, arth, rr, REG, REG) \
+	X(0x0A, lgic, rr, REG, REG)
+
+/* Dispatch table indexes. Reference handlers come first, indexed by
+ * instruction ID - 1, followed by the specialized handlers.
+ */
+#define INSTRUCTION_VARIANT_INDEX(id, op, sfx, t1, t2) INSTRUCTION_##op##_##sfx,
+
+enum {
+	INSTRUCTION_VARIANT_BASE = INSTRUCTION_SET_SIZE - 1,
+	INSTRUCTION_VARIANTS(INSTRUCTION_VARIANT_INDEX)
+	INSTRUCTION_VARIANT_MAX
+};
+
+/* Superinstructions, fused at decode time. A cpvl configuring RCMP, RARTH
+ * or RLGIC is merged with the instruction that consumes it.
+ */
+enum {
+	INSTRUCTION_FUSE_NONE,
+	INSTRUCTION_FUSE_CPVL_CMP,	/* cpvl <mode>, rcmp; cmp <r>, <r> */
+	INSTRUCTION_FUSE_CPVL_CMP_JMP,	/* ... followed by jmp <addr> */
+	INSTRUCTION_FUSE_CPVL_ARTH,	/* cpvl <op>, rarth; arth <r>, <r> */
+	INSTRUCTION_FUSE_CPVL_LGIC,	/* cpvl <op>, rlgic; lgic <r>, <r> */
+	INSTRUCTION_FUSE_CMP_JMP,	/* cmp <r>, <r>; jmp <addr> */
+	INSTRUCTION_FUSE_LOOP_COPY,	/* Word copy loop, see instruction_loop */
+	INSTRUCTION_FUSE_LOOP_FILL,	/* Word fill loop */
+	INSTRUCTION_FUSE_LOOP_CMP,	/* Word compare loop */
+	INSTRUCTION_FUSE_MAX
+};
+
+/* Loop idioms run at most this many iterations on the host per dispatch,
+ * bounding the hardware interrupt latency.
+ */
+#define INSTRUCTION_LOOP_CHUNK		4096
+
+/* Macros */
+#define instruction_mode(rst) ((((rst) & REG_RST_BIT_PAGING) ? INSTRUCTION_MODE_PAGING : 0) | (((rst) & REG_RST_BIT_LOWPRIV) ? INSTRUCTION_MODE_LOWPRIV : 0))
+
+struct decode;
+void instruction_specialize(struct decode *);
+void instruction_fuse(struct decode *);
+
 /* External variables */
 const struct instruction instruction[INSTRUCTION_SET_SIZE];
+extern void (*const instruction_dispatch[INSTRUCTION_MODES][INSTRUCTION_VARIANT_MAX]) (leg_addr_t, leg_addr_t, uint8_t, uint8_t, uint8_t);
+extern void (*const instruction_fused[INSTRUCTION_MODES][INSTRUCTION_FUSE_MAX]) (const struct decode *);
 
 #endif
 
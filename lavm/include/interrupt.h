@@ -42,9 +42,14 @@ void interrupt_int01(leg_addr_t, leg_addr_t, leg_addr_t);
 void interrupt_int03(void);
 void interrupt_int09(uint32_t);
 void interrupt_int0a(leg_addr_t);
-void interrupt_int0b(leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t);
+void interrupt_int0b(leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t);
 void interrupt_int0d(leg_addr_t);
 void interrupt_int0f(leg_addr_t, leg_addr_t, leg_addr_t);
 void interrupt_int10(uint8_t);
+void interrupt_int11(leg_addr_t, leg_addr_t, leg_addr_t);
+void interrupt_int12(leg_addr_t, leg_addr_t);
+void interrupt_int13(leg_addr_t, leg_addr_t);
+void interrupt_int14(leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t, leg_addr_t);
+void interrupt_int15(void);
 
 #endif
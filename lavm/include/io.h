@@ -23,6 +23,28 @@
 
 #include "archdefs.h"
 
+/* Asynchronous requests are submitted to an io_uring and reaped while
+ * checking for hardware interrupts. Without it, or on hosts refusing it,
+ * they are performed when submitted and complete on the next check.
+ */
+#if IO_URING_SUPPORT && defined(__linux__)
+ #define IO_URING		1
+#else
+ #define IO_URING		0
+#endif
+
+#define IO_ASYNC_MAX		64	/* Asynchronous requests in flight */
+
+/* Storage descriptors served by INTR_13 */
+#define IO_DESC_SIZE		24
+#define IO_DESC_FLAGS		0x00
+#define IO_DESC_OFFSET_HI	0x04
+#define IO_DESC_OFFSET_LO	0x08
+#define IO_DESC_LEN		0x0C
+#define IO_DESC_ADDR		0x10
+#define IO_DESC_STATUS		0x14
+#define IO_DESC_MERGE_MAX	64	/* Adjacent descriptors served per host call */
+
 /* Data structures */
 struct io {
 	int fdstor[HW_STOR_MAX];	/* Storage file descriptor array */
@@ -37,6 +59,11 @@ int io_storage_write_extended(uint16_t, leg_addr_t, uint64_t, size_t);
 int io_storage_write(uint16_t, leg_addr_t, size_t, size_t);
 int io_storage_read_extended(uint16_t, leg_addr_t, uint64_t, size_t);
 int io_storage_read(uint16_t, leg_addr_t, size_t, size_t);
+int io_storage_submit(uint16_t, leg_addr_t, uint64_t, size_t, int, leg_addr_t);
+int io_storage_complete(leg_addr_t *, leg_addr_t *);
+leg_addr_t io_storage_queue(leg_addr_t, leg_addr_t);
+ssize_t io_storage_pread(uint16_t, void *, size_t, uint64_t);
+ssize_t io_storage_pwrite(uint16_t, const void *, size_t, uint64_t);
 void io_init(void);
 void io_destroy(void);
 
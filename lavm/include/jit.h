@@ -0,0 +1,61 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+#include "archdefs.h"
+
+/* Code cache geometry */
+#define JIT_CACHE_SIZE		4096	/* Number of blocks (power of 2) */
+#define JIT_CODE_SIZE		(4 * 1024 * 1024) /* Host code buffer, in bytes */
+#define JIT_BLOCK_INSNS		64	/* Maximum guest instructions per block */
+#define JIT_INSN_CODE_MAX	512	/* Host code bound per guest instruction */
+#define JIT_THRESHOLD		32	/* Interpreted executions before compiling */
+
+/* Data Structures */
+struct jit_block {
+	leg_addr_t paddr;	/* Physical address of the first instruction */
+	leg_addr_t span;	/* Guest bytes covered, 0 if not compiled */
+	uint8_t mode;		/* Execution mode the block was built for */
+	uint8_t hits;		/* Interpreted executions of paddr */
+	int (*code) (void);	/* Host code. Returns 1 if interrupts were checked */
+};
+
+struct jit {
+	struct jit_block block[JIT_CACHE_SIZE];
+	uint8_t *code;		/* Executable code buffer */
+	uint32_t used;		/* Bytes in use on the code buffer */
+	uint32_t blocks;	/* Number of compiled blocks */
+	volatile uint8_t dirty;	/* Set when a compiled block is invalidated */
+};
+
+/* External variables */
+extern struct jit jit;
+
+/* Prototypes */
+struct jit_block *jit_lookup(leg_addr_t, int);
+void jit_hint(leg_addr_t, int);
+void jit_invalidate(leg_addr_t, leg_addr_t);
+void jit_flush(void);
+int jit_init(void);
+void jit_destroy(void);
+
+#endif
+
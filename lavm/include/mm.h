@@ -19,15 +19,229 @@
 #define MM_H
 
 #include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
 
 #include "archdefs.h"
+#include "config.h"
+#include "fault.h"
+
+/* RAM allocation options */
+#define MM_OPT_HUGETLB		0x01	/* Back RAM with reserved huge pages */
+#define MM_OPT_THP		0x02	/* Advise transparent huge pages */
+#define MM_OPT_POPULATE		0x04	/* Prefault RAM at boot */
+#define MM_OPT_NORESERVE	0x08	/* Don't reserve swap for sparse RAM */
+#define MM_OPT_DIRTY		0x10	/* Track stores to RAM */
+#define MM_OPT_MERGE		0x20	/* Let the host merge identical RAM pages */
+
+#define MM_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+/* RAM is placed at the start of a region reserving the whole address space,
+ * so guest accesses past RAM trap instead of being checked.
+ */
+#if MM_GUARD_REGION_SUPPORT && defined(__linux__) && (ARCH_ADDR_BITS == 32) && (UINTPTR_MAX > 0xFFFFFFFFUL)
+ #define MM_GUARD_REGION	1
+#else
+ #define MM_GUARD_REGION	0
+#endif
+
+#define MM_GUARD_SIZE		((1ULL << ARCH_ADDR_BITS) + MM_HUGEPAGE_SIZE)	/* Room for an access at the last address */
+
+/* Watched RAM is write protected on the host. Stores that trap are logged and
+ * then single stepped through the x86 trap flag, so unwatched RAM pays
+ * nothing.
+ */
+#if MM_WATCH_SUPPORT && defined(__linux__) && defined(__x86_64__)
+ #define MM_WATCH		1
+#else
+ #define MM_WATCH		0
+#endif
+
+#define MM_WATCH_STEP_MAX	2	/* Pages a single host store may span */
+#define MM_WATCH_IO_MAX		160	/* Host I/O ranges written at once, above ring reads plus a merged vector */
+
+/* Boot images read from storage, those matching an AOT translation, are
+ * mapped copy-on-write from files in the shared directory, named after the
+ * image hash, so VMs booting the same images share their pages through the
+ * host page cache. Other reads may hold private data and are never shared.
+ */
+#define MM_SHARE_MIN_SIZE	(64 * 1024)	/* Smaller images aren't worth a file */
+#define MM_SHARE_SUFFIX		".img"
+
+/* Storage windows map a region of a storage image over RAM, so guest loads
+ * and stores reach the host page cache directly.
+ */
+#define MM_WINDOW_MAX		16	/* Windows mapped at once */
+
+/* Dirty RAM is tracked by write protecting it on the host. The first store to
+ * each clean chunk traps and unprotects it.
+ */
+#if MM_DIRTY_SUPPORT && defined(__linux__)
+ #define MM_DIRTY		1
+#else
+ #define MM_DIRTY		0
+#endif
+
+/* Data structures */
+struct mm_guard {
+	sigjmp_buf env;		/* Where traps resume the VM thread */
+	pthread_t thread;	/* VM thread */
+	leg_addr_t addr;	/* Address of the last trapped access */
+	int armed;
+};
+
+struct mm_share {
+	uint64_t mapped;	/* Bytes of RAM mapped from shared images */
+};
+
+struct mm_balloon {
+	size_t page;		/* Bytes released per bit */
+	uint64_t *bitmap;	/* Set bits are pages held by the balloon */
+	uint64_t bytes;		/* Bytes held by the balloon */
+};
+
+struct mm_dirty {
+	size_t chunk;		/* Bytes tracked per bit */
+	size_t count;		/* Chunks in RAM */
+	uint64_t *bitmap;	/* Set bits are dirty chunks */
+};
 
 /* Extern variables */
 extern volatile void *mm;
+extern struct mm_guard mm_guard;
+extern struct mm_dirty mm_dirty;
+extern struct mm_share mm_share;
+extern struct mm_balloon mm_balloon;
 
 /* Prototypes */
-int mm_grant_zone_normal(leg_addr_t);
+int mm_grant_zone_normal_io(leg_addr_t);
+void mm_guard_trap(void *);
+int mm_watch_init(void);
+int mm_watch_trap(void *);
+void mm_watch_step(void);
+void mm_watch_io_begin(leg_addr_t, size_t);
+void mm_watch_io_end(leg_addr_t, size_t);
+int mm_dirty_init(void);
+int mm_dirty_trap(void *);
+void mm_dirty_io(leg_addr_t, size_t);
+size_t mm_dirty_fetch(uint64_t *, int);
+void mm_dirty_stats(void);
+int mm_share_image(leg_addr_t, size_t);
+void mm_share_stats(void);
+int mm_balloon_inflate(leg_addr_t, size_t);
+void mm_balloon_deflate(leg_addr_t, size_t);
+void mm_balloon_stats(void);
+int mm_window_check(leg_addr_t, size_t, uint64_t);
+int mm_window_map(leg_addr_t, size_t, int, uint64_t);
+int mm_window_unmap(leg_addr_t, size_t);
+int mm_window_mapped(int, uint64_t, uint64_t);
+int mm_window_sync(leg_addr_t, size_t);
 int mm_init(void);
 void mm_destroy(void);
 
+/* Inline routines */
+
+/* Grant that the guest may access addr. Only valid right before mm is
+ * accessed, as the RAM boundary may be enforced by the host MMU. Host I/O
+ * must use mm_grant_zone_normal_io() instead.
+ */
+static inline int mm_grant_zone_normal(leg_addr_t addr) {
+#if !MM_GUARD_REGION
+	if (addr >= config.vm.ram) {
+		fault_bad_mm(addr);
+		return 0;
+	}
+#endif
+
+	if (addr < MM_ZONE_NORMAL) {
+		fault_no_priv();
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Typed access to guest physical memory. The guest is big endian and its
+ * addresses carry no alignment guarantees, so values are copied with memcpy()
+ * and byte swapped as required. Callers must have granted addr already.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+ #define MM_BSWAP16(x)		__builtin_bswap16(x)
+ #define MM_BSWAP32(x)		__builtin_bswap32(x)
+ #define MM_BSWAP64(x)		__builtin_bswap64(x)
+#else
+ #define MM_BSWAP16(x)		(x)
+ #define MM_BSWAP32(x)		(x)
+ #define MM_BSWAP64(x)		(x)
+#endif
+
+static inline void *mm_ptr(leg_addr_t addr) {
+	return (char *) mm + addr;
+}
+
+static inline uint8_t mm_load8(leg_addr_t addr) {
+	return *(uint8_t *) mm_ptr(addr);
+}
+
+static inline uint16_t mm_load16(leg_addr_t addr) {
+	uint16_t val;
+
+	memcpy(&val, mm_ptr(addr), sizeof(val));
+
+	return MM_BSWAP16(val);
+}
+
+static inline uint32_t mm_load32(leg_addr_t addr) {
+	uint32_t val;
+
+	memcpy(&val, mm_ptr(addr), sizeof(val));
+
+	return MM_BSWAP32(val);
+}
+
+static inline uint64_t mm_load64(leg_addr_t addr) {
+	uint64_t val;
+
+	memcpy(&val, mm_ptr(addr), sizeof(val));
+
+	return MM_BSWAP64(val);
+}
+
+static inline void mm_store8(leg_addr_t addr, uint8_t val) {
+	*(uint8_t *) mm_ptr(addr) = val;
+}
+
+static inline void mm_store16(leg_addr_t addr, uint16_t val) {
+	val = MM_BSWAP16(val);
+	memcpy(mm_ptr(addr), &val, sizeof(val));
+}
+
+static inline void mm_store32(leg_addr_t addr, uint32_t val) {
+	val = MM_BSWAP32(val);
+	memcpy(mm_ptr(addr), &val, sizeof(val));
+}
+
+static inline void mm_store64(leg_addr_t addr, uint64_t val) {
+	val = MM_BSWAP64(val);
+	memcpy(mm_ptr(addr), &val, sizeof(val));
+}
+
+/* Address sized words, as held by registers */
+static inline leg_addr_t mm_load_addr(leg_addr_t addr) {
+#if ARCH_ADDR_BITS == 32
+	return mm_load32(addr);
+#else
+	return mm_load64(addr);
+#endif
+}
+
+static inline void mm_store_addr(leg_addr_t addr, leg_addr_t val) {
+#if ARCH_ADDR_BITS == 32
+	mm_store32(addr, val);
+#else
+	mm_store64(addr, val);
+#endif
+}
+
 #endif
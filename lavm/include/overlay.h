@@ -0,0 +1,78 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "archdefs.h"
+
+/* Storage NN is an overlay if <storage dir>/NNbase exists. NNbase is the
+ * read-only base image, usually a link to an image shared between VMs.
+ * NNstorage holds the blocks written by this VM at their own offsets, as a
+ * sparse file, and NNmap tracks which blocks it holds. Reads of the other
+ * blocks fall through to the base image.
+ */
+#define OVERLAY_BASE		"base"
+#define OVERLAY_MAP		"map"
+#define OVERLAY_BLOCK_SIZE	4096	/* Block size of new maps */
+
+/* Map file format. Header fields are stored in network byte order and
+ * followed by the map, one bit per block, set if held by the overlay.
+ */
+#define OVERLAY_MAGIC		0x4C434F57	/* "LCOW" */
+#define OVERLAY_VERSION		1
+
+struct overlay_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t reserved;
+};
+
+/* Data structures */
+struct overlay {
+	uint8_t *map;		/* NULL if the storage isn't an overlay */
+	uint64_t map_size;	/* Bytes of map */
+	size_t block;		/* Bytes per block */
+	int fdbase;
+	int fdmap;
+	uint64_t base_size;
+	uint64_t size;		/* Bytes held by the overlay file */
+};
+
+/* External variables */
+extern struct overlay overlay[HW_STOR_MAX];
+
+/* Prototypes */
+int overlay_init(uint16_t, const char *);
+ssize_t overlay_read(uint16_t, void *, size_t, uint64_t);
+ssize_t overlay_write(uint16_t, const void *, size_t, uint64_t);
+int overlay_copyup(uint16_t, uint64_t, size_t);
+void overlay_destroy(void);
+
+/* Inline routines */
+static inline int overlay_active(uint16_t storid) {
+	return overlay[storid].map != NULL;
+}
+
+#endif
+
@@ -21,9 +21,36 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 
+#include "archdefs.h"
+#include "register.h"
+#include "mm.h"
+
 #define PAGE_PERM_RO	0x01
 #define PAGE_PERM_RW	0x02
 #define PAGE_PERM_EXEC	0x04
+#define PAGE_RADIX_PRESENT	0x08
+
+/* Radix page tables. RPA holds the physical address of a directory, whose
+ * entries point to tables, whose entries map fixed-size pages. Entries are
+ * 32-bit words in network byte order holding the table or page frame
+ * address in the upper bits, and PAGE_RADIX_PRESENT in the lower bits.
+ * Table entries also hold the page PAGE_PERM_* bits.
+ */
+#define PAGING_RADIX_SHIFT	12	/* 4KiB pages */
+#define PAGING_RADIX_BITS	10	/* 1024 entries per directory and table */
+#define PAGING_RADIX_PAGE_SIZE	(1 << PAGING_RADIX_SHIFT)
+#define PAGING_RADIX_ENTRIES	(1 << PAGING_RADIX_BITS)
+#define PAGING_RADIX_FRAME_MASK	(~(PAGING_RADIX_PAGE_SIZE - 1))
+
+/* Translation cache geometry */
+#define PAGING_TLB_SETS		256	/* Number of sets (power of 2) */
+#define PAGING_TLB_WAYS		4	/* Entries per set */
+#define PAGING_TLB_SHIFT	12	/* Pages are indexed by 4KiB block ... */
+#define PAGING_TLB_WORD_SHIFT	2	/* ... single address pages by word */
+
+/* Page list indexes */
+#define PAGING_INDEX_MAX	16	/* Page lists (RPA values) indexed at once */
+#define PAGING_INDEX_PAGES_MAX	65536	/* Longer lists are walked instead */
 
 #define paging_size(pgptr)	(ntohl(pgptr->size))
 #define paging_perm_is_ro(pgptr)	(ntohl(pgptr->flags) & PAGE_PERM_RO)
@@ -43,9 +70,108 @@ struct page {
 };
 #pragma pack(pop)
 
+/* Data Structures */
+struct paging_tlb_entry {
+	leg_addr_t rpa;		/* RPA the entry belongs to */
+	leg_addr_t format;	/* REG_RST_BIT_RADIX of RST */
+	leg_addr_t start;	/* First logical address translated */
+	leg_addr_t end;		/* Last logical address translated */
+	leg_addr_t base;	/* Translation is base + (laddr ^ mask), as */
+	leg_addr_t mask;	/* page lists translate backwards */
+	leg_addr_t paddr;	/* Page physical base address */
+	leg_addr_t flags;	/* Page permissions */
+	uint8_t valid;
+};
+
+struct paging_tlb {
+	struct paging_tlb_entry entry[PAGING_TLB_SETS][PAGING_TLB_WAYS];
+	uint8_t victim[PAGING_TLB_SETS];	/* Next way to replace */
+	uint8_t *map;		/* One bit per code block holding page entries */
+	leg_addr_t map_blocks;	/* Number of blocks covered by the map */
+	uint32_t count;		/* Number of valid entries */
+};
+
+struct paging_index_page {
+	leg_addr_t addr;	/* Physical address of the page entry */
+	leg_addr_t laddr;	/* Entry fields, in host byte order */
+	leg_addr_t paddr;
+	leg_addr_t size;
+	leg_addr_t flags;
+	leg_addr_t next;
+};
+
+struct paging_index_ref {
+	leg_addr_t key;
+	uint32_t page;
+};
+
+struct paging_index_range {
+	leg_addr_t start;	/* First logical address */
+	leg_addr_t end;		/* Last logical address */
+	uint32_t page;		/* First page of the list matching the range */
+};
+
+struct paging_index {
+	leg_addr_t rpa;		/* RPA the list was read from */
+	struct paging_index_page *page;	/* Pages, in list order */
+	struct paging_index_ref *byaddr;	/* Pages, sorted by entry address */
+	struct paging_index_range *range;	/* Sorted, disjoint ranges */
+	uint32_t count;		/* Number of pages. Zero if the list is walked */
+	uint32_t ranges;	/* Number of ranges */
+	uint8_t dirty;		/* Ranges must be rebuilt */
+	uint8_t valid;
+};
+
+struct paging_map {
+	struct paging_index index[PAGING_INDEX_MAX];
+	unsigned int victim;	/* Next index to replace */
+};
+
+/* External variables */
+extern struct paging_tlb tlb;
+extern struct paging_map pmap;
+
 /* Prototypes */
 struct page *paging_get_laddr_page(leg_addr_t laddr);
-leg_addr_t paging_get_paddr(leg_addr_t laddr, leg_addr_t flags);
+leg_addr_t paging_get_paddr_slow(leg_addr_t laddr, leg_addr_t flags);
+void paging_tlb_invalidate(leg_addr_t);
+void paging_tlb_write(leg_addr_t, leg_addr_t);
+void paging_tlb_flush(void);
+int paging_init(void);
+void paging_destroy(void);
+
+/* Inline routines */
+static inline struct paging_tlb_entry *paging_tlb_probe(leg_addr_t key, leg_addr_t laddr, leg_addr_t flags) {
+	struct paging_tlb_entry *e = tlb.entry[key & (PAGING_TLB_SETS - 1)];
+	int i;
+
+	for (i = 0; i < PAGING_TLB_WAYS; i++, e++) {
+		if (e->valid && (e->rpa == regs.rpa) && (e->format == (regs.rst & REG_RST_BIT_RADIX)) && (laddr >= e->start) && (laddr <= e->end) && (e->flags & flags))
+			return e;
+	}
+
+	return NULL;
+}
+
+static inline leg_addr_t paging_get_paddr(leg_addr_t laddr, leg_addr_t flags) {
+	struct paging_tlb_entry *e;
+
+	if ((e = paging_tlb_probe(laddr >> PAGING_TLB_SHIFT, laddr, flags)) || (e = paging_tlb_probe(laddr >> PAGING_TLB_WORD_SHIFT, laddr, flags)))
+		return e->base + (laddr ^ e->mask);
+
+	/* Walk the page list, faulting as required */
+	return paging_get_paddr_slow(laddr, flags);
+}
+
+/* Translate *addr to a physical address, if paging is enabled, and grant that
+ * the guest may access it through the mm_load*() and mm_store*() routines.
+ */
+static inline int paging_grant_paddr(leg_addr_t *addr, leg_addr_t flags, int paging) {
+	if (paging && !(*addr = paging_get_paddr(*addr, flags)))
+		return 0;
+
+	return mm_grant_zone_normal(*addr);
+}
 
 #endif
 
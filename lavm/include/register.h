@@ -61,6 +61,7 @@ volatile void *register_decode(leg_addr_t regid);
 int register_grant_any(leg_addr_t regid);
 int register_grant_arth(leg_addr_t regid);
 int register_grant_rfp(leg_addr_t regid);
+int register_is_valid(leg_addr_t regid);
 int register_is_rfp(leg_addr_t regid);
 
 #endif
@@ -18,9 +18,37 @@
 #ifndef RUN_H
 #define RUN_H
 
+#include <stdint.h>
+#include <time.h>
+
+#include "archdefs.h"
+
+/* Execution cores */
+#define RUN_CORE_DEFAULT	0	/* Best core available */
+#define RUN_CORE_TABLE		1	/* Instruction table dispatch */
+#define RUN_CORE_THREADED	2	/* Direct threaded dispatch */
+#define RUN_CORE_JIT		3	/* Basic block compiler */
+
+/* The threaded core relies on labels as values */
+#if RUN_THREADED_SUPPORT && defined(__GNUC__)
+ #define RUN_THREADED		1
+#else
+ #define RUN_THREADED		0
+#endif
+
+/* The JIT core emits x86-64 code and calls the handlers with the SysV ABI */
+#if RUN_JIT_SUPPORT && defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+ #define RUN_JIT		1
+#else
+ #define RUN_JIT		0
+#endif
+
 /* Data Structures */
 struct run {
 	uint32_t opcode;	/* Current opcode */
+	uint8_t core;		/* Execution core in use */
+	uint64_t icount;	/* Number of dispatched instructions */
+	struct timespec start;	/* Execution start time */
 };
 
 /* External variables */
@@ -28,5 +56,6 @@ extern volatile struct run run;
 
 /* Prototypes */
 void run_start(void);
+void run_stats(void);
 
 #endif
@@ -18,8 +18,11 @@
 #ifndef SIGHANDLER_H
 #define SIGHANDLER_H
 
+#define SIGHANDLER_EFL_TF	0x100	/* x86 trap flag, single steps the host */
+
 /* Prototypes */
 void sighandler_init(void);
+void sighandler_pause(void);
 
 #endif
 
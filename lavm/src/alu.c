@@ -15,15 +15,54 @@
 
 */
 
+#include <string.h>
+
 #include "archdefs.h"
 #include "register.h"
 #include "fault.h"
 #include "alu.h"
+#include "fpu.h"
+
+struct alu_flags alu_flags;
+
+#define ALU_FLAGS_EVAL(kind, size, type, eval) \
+	case ((kind) << 4) | (size): { \
+		type from = (type) alu_flags.from, to = (type) alu_flags.to; \
+		eval(type); \
+		break; \
+	}
+
+#define ALU_FLAGS_EVAL_SIGNED(kind, eval) \
+	ALU_FLAGS_EVAL(kind, 1, int8_t, eval) \
+	ALU_FLAGS_EVAL(kind, 2, int16_t, eval) \
+	ALU_FLAGS_EVAL(kind, 4, int32_t, eval) \
+	ALU_FLAGS_EVAL(kind, 8, int64_t, eval)
+
+#define ALU_FLAGS_EVAL_UNSIGNED(kind, eval) \
+	ALU_FLAGS_EVAL(kind, 1, uint8_t, eval) \
+	ALU_FLAGS_EVAL(kind, 2, uint16_t, eval) \
+	ALU_FLAGS_EVAL(kind, 4, uint32_t, eval) \
+	ALU_FLAGS_EVAL(kind, 8, uint64_t, eval)
+
+void alu_flags_eval(void) {
+	uint8_t op = alu_flags.op;
+
+	alu_flags.op = ALU_FLAGS_NONE;
+
+	switch ((op << 4) | alu_flags.size) {
+		ALU_FLAGS_EVAL_SIGNED(ALU_FLAGS_ADD_SIGNED, alu_add_signed_eval_uf_of)
+		ALU_FLAGS_EVAL_UNSIGNED(ALU_FLAGS_ADD_UNSIGNED, alu_add_unsigned_eval_uf_of)
+		ALU_FLAGS_EVAL_SIGNED(ALU_FLAGS_SUB_SIGNED, alu_sub_signed_eval_uf_of)
+		ALU_FLAGS_EVAL_UNSIGNED(ALU_FLAGS_SUB_UNSIGNED, alu_sub_unsigned_eval_uf_of)
+		ALU_FLAGS_EVAL_SIGNED(ALU_FLAGS_MUL_SIGNED, alu_mul_signed_eval_uf_of)
+		ALU_FLAGS_EVAL_UNSIGNED(ALU_FLAGS_MUL_UNSIGNED, alu_mul_unsigned_eval_uf_of)
+	}
+}
 
 leg_char_t alu_add_char(leg_char_t from, leg_char_t to) {
 	leg_char_t res = to + from;
 
-	alu_add_signed_eval_uf_of(leg_char_t);
+	alu_add_signed_defer_uf_of(leg_char_t);
 
 	return res;
 }
@@ -31,7 +70,7 @@ leg_char_t alu_add_char(leg_char_t from, leg_char_t to) {
 leg_uchar_t alu_add_uchar(leg_uchar_t from, leg_uchar_t to) {
 	leg_uchar_t res = to + from;
 
-	alu_add_unsigned_eval_uf_of(leg_uchar_t);
+	alu_add_unsigned_defer_uf_of(leg_uchar_t);
 
 	return res;
 }
@@ -39,7 +78,7 @@ leg_uchar_t alu_add_uchar(leg_uchar_t from, leg_uchar_t to) {
 leg_short_t alu_add_short(leg_short_t from, leg_short_t to) {
 	leg_short_t res = to + from;
 
-	alu_add_signed_eval_uf_of(leg_short_t);
+	alu_add_signed_defer_uf_of(leg_short_t);
 
 	return res;
 }
@@ -47,7 +86,7 @@ leg_short_t alu_add_short(leg_short_t from, leg_short_t to) {
 leg_ushort_t alu_add_ushort(leg_ushort_t from, leg_ushort_t to) {
 	leg_ushort_t res = to + from;
 
-	alu_add_unsigned_eval_uf_of(leg_ushort_t);
+	alu_add_unsigned_defer_uf_of(leg_ushort_t);
 
 	return res;
 }
@@ -55,7 +94,7 @@ leg_ushort_t alu_add_ushort(leg_ushort_t from, leg_ushort_t to) {
 leg_int_t alu_add_int(leg_int_t from, leg_int_t to) {
 	leg_int_t res = to + from;
 
-	alu_add_signed_eval_uf_of(leg_int_t);
+	alu_add_signed_defer_uf_of(leg_int_t);
 
 	return res;
 }
@@ -63,7 +102,7 @@ leg_int_t alu_add_int(leg_int_t from, leg_int_t to) {
 leg_uint_t alu_add_uint(leg_uint_t from, leg_uint_t to) {
 	leg_uint_t res = to + from;
 
-	alu_add_unsigned_eval_uf_of(leg_uint_t);
+	alu_add_unsigned_defer_uf_of(leg_uint_t);
 
 	return res;
 }
@@ -71,7 +110,7 @@ leg_uint_t alu_add_uint(leg_uint_t from, leg_uint_t to) {
 leg_long_t alu_add_long(leg_long_t from, leg_long_t to) {
 	leg_long_t res = to + from;
 
-	alu_add_signed_eval_uf_of(leg_long_t);
+	alu_add_signed_defer_uf_of(leg_long_t);
 
 	return res;
 }
@@ -93,10 +132,10 @@ leg_ulong_t alu_add_ulong(leg_ulong_t from, leg_ulong_t to) {
 	} else if (regs.rarth & REG_ARTH_BIT_ERAL4) {
 		regs.ral4 = (res_ext & 0xffffffff00000000) >> 32;
 	} else {
-		alu_add_unsigned_eval_uf_of(leg_ulong_t);
+		alu_add_unsigned_defer_uf_of(leg_ulong_t);
 	}
 #elif ARCH_ADDR_BITS == 64
-	alu_add_unsigned_eval_uf_of(leg_ulong_t);
+	alu_add_unsigned_defer_uf_of(leg_ulong_t);
 	/* TODO: Extended operands not yet implemented for LEG64 */
 #endif
 
@@ -106,7 +145,7 @@ leg_ulong_t alu_add_ulong(leg_ulong_t from, leg_ulong_t to) {
 leg_char_t alu_sub_char(leg_char_t from, leg_char_t to) {
 	leg_char_t res = to - from;
 
-	alu_sub_signed_eval_uf_of(leg_char_t);
+	alu_sub_signed_defer_uf_of(leg_char_t);
 
 	return res;
 }
@@ -114,7 +153,7 @@ leg_char_t alu_sub_char(leg_char_t from, leg_char_t to) {
 leg_uchar_t alu_sub_uchar(leg_uchar_t from, leg_uchar_t to) {
 	leg_uchar_t res = to - from;
 
-	alu_sub_unsigned_eval_uf_of(leg_uchar_t);
+	alu_sub_unsigned_defer_uf_of(leg_uchar_t);
 
 	return res;
 }
@@ -122,7 +161,7 @@ leg_uchar_t alu_sub_uchar(leg_uchar_t from, leg_uchar_t to) {
 leg_short_t alu_sub_short(leg_short_t from, leg_short_t to) {
 	leg_short_t res = to - from;
 
-	alu_sub_signed_eval_uf_of(leg_short_t);
+	alu_sub_signed_defer_uf_of(leg_short_t);
 
 	return res;
 }
@@ -130,7 +169,7 @@ leg_short_t alu_sub_short(leg_short_t from, leg_short_t to) {
 leg_ushort_t alu_sub_ushort(leg_ushort_t from, leg_ushort_t to) {
 	leg_ushort_t res = to - from;
 
-	alu_sub_unsigned_eval_uf_of(leg_ushort_t);
+	alu_sub_unsigned_defer_uf_of(leg_ushort_t);
 
 	return res;
 }
@@ -138,7 +177,7 @@ leg_ushort_t alu_sub_ushort(leg_ushort_t from, leg_ushort_t to) {
 leg_int_t alu_sub_int(leg_int_t from, leg_int_t to) {
 	leg_int_t res = to - from;
 
-	alu_sub_signed_eval_uf_of(leg_int_t);
+	alu_sub_signed_defer_uf_of(leg_int_t);
 
 	return res;
 }
@@ -146,7 +185,7 @@ leg_int_t alu_sub_int(leg_int_t from, leg_int_t to) {
 leg_uint_t alu_sub_uint(leg_uint_t from, leg_uint_t to) {
 	leg_uint_t res = to - from;
 
-	alu_sub_unsigned_eval_uf_of(leg_uint_t);
+	alu_sub_unsigned_defer_uf_of(leg_uint_t);
 
 	return res;
 }
@@ -154,7 +193,7 @@ leg_uint_t alu_sub_uint(leg_uint_t from, leg_uint_t to) {
 leg_long_t alu_sub_long(leg_long_t from, leg_long_t to) {
 	leg_long_t res = to - from;
 
-	alu_sub_signed_eval_uf_of(leg_long_t);
+	alu_sub_signed_defer_uf_of(leg_long_t);
 
 	return res;
 }
@@ -176,10 +215,10 @@ leg_ulong_t alu_sub_ulong(leg_ulong_t from, leg_ulong_t to) {
 	} else if (regs.rarth & REG_ARTH_BIT_ERAL4) {
 		regs.ral4 = (res_ext & 0xffffffff00000000) >> 32;
 	} else {
-		alu_sub_unsigned_eval_uf_of(leg_ulong_t);
+		alu_sub_unsigned_defer_uf_of(leg_ulong_t);
 	}
 #elif ARCH_ADDR_BITS == 64
-	alu_sub_unsigned_eval_uf_of(leg_ulong_t);
+	alu_sub_unsigned_defer_uf_of(leg_ulong_t);
 	/* TODO: Extended operands not yet implemented for LEG64 */
 #endif
 
@@ -189,7 +228,7 @@ leg_ulong_t alu_sub_ulong(leg_ulong_t from, leg_ulong_t to) {
 leg_char_t alu_mul_char(leg_char_t from, leg_char_t to) {
 	leg_char_t res = to * from;
 
-	alu_mul_signed_eval_uf_of(leg_char_t);
+	alu_mul_signed_defer_uf_of(leg_char_t);
 
 	return res;
 }
@@ -197,7 +236,7 @@ leg_char_t alu_mul_char(leg_char_t from, leg_char_t to) {
 leg_uchar_t alu_mul_uchar(leg_uchar_t from, leg_uchar_t to) {
 	leg_uchar_t res = to * from;
 
-	alu_mul_unsigned_eval_uf_of(leg_uchar_t);
+	alu_mul_unsigned_defer_uf_of(leg_uchar_t);
 
 	return res;
 }
@@ -205,7 +244,7 @@ leg_uchar_t alu_mul_uchar(leg_uchar_t from, leg_uchar_t to) {
 leg_short_t alu_mul_short(leg_short_t from, leg_short_t to) {
 	leg_short_t res = to * from;
 
-	alu_mul_signed_eval_uf_of(leg_short_t);
+	alu_mul_signed_defer_uf_of(leg_short_t);
 
 	return res;
 }
@@ -213,7 +252,7 @@ leg_short_t alu_mul_short(leg_short_t from, leg_short_t to) {
 leg_ushort_t alu_mul_ushort(leg_ushort_t from, leg_ushort_t to) {
 	leg_ushort_t res = to * from;
 
-	alu_mul_unsigned_eval_uf_of(leg_ushort_t);
+	alu_mul_unsigned_defer_uf_of(leg_ushort_t);
 
 	return res;
 }
@@ -221,7 +260,7 @@ leg_ushort_t alu_mul_ushort(leg_ushort_t from, leg_ushort_t to) {
 leg_int_t alu_mul_int(leg_int_t from, leg_int_t to) {
 	leg_int_t res = to * from;
 
-	alu_mul_signed_eval_uf_of(leg_int_t);
+	alu_mul_signed_defer_uf_of(leg_int_t);
 
 	return res;
 }
@@ -229,7 +268,7 @@ leg_int_t alu_mul_int(leg_int_t from, leg_int_t to) {
 leg_uint_t alu_mul_uint(leg_uint_t from, leg_uint_t to) {
 	leg_uint_t res = to * from;
 
-	alu_mul_unsigned_eval_uf_of(leg_uint_t);
+	alu_mul_unsigned_defer_uf_of(leg_uint_t);
 
 	return res;
 }
@@ -237,7 +276,7 @@ leg_uint_t alu_mul_uint(leg_uint_t from, leg_uint_t to) {
 leg_long_t alu_mul_long(leg_long_t from, leg_long_t to) {
 	leg_long_t res = to * from;
 
-	alu_mul_signed_eval_uf_of(leg_long_t);
+	alu_mul_signed_defer_uf_of(leg_long_t);
 
 	return res;
 }
@@ -259,10 +298,10 @@ leg_ulong_t alu_mul_ulong(leg_ulong_t from, leg_ulong_t to) {
 	} else if (regs.rarth & REG_ARTH_BIT_ERAL4) {
 		regs.ral4 = (res_ext & 0xffffffff00000000) >> 32;
 	} else {
-		alu_mul_unsigned_eval_uf_of(leg_ulong_t);
+		alu_mul_unsigned_defer_uf_of(leg_ulong_t);
 	}
 #elif ARCH_ADDR_BITS == 64
-	alu_mul_unsigned_eval_uf_of(leg_ulong_t);
+	alu_mul_unsigned_defer_uf_of(leg_ulong_t);
 	/* TODO: Extended operands not yet implemented for LEG64 */
 #endif
 
@@ -639,3 +678,304 @@ leg_ulong_t alu_ror_ulong(leg_ulong_t from, leg_ulong_t to) {
 	return ((to << ((sizeof(leg_ulong_t) >> 3) - from) | (to >> from)) & (leg_ulong_t) ~0);
 }
 
+/* Arithmetic and logic kernels
+ *
+ * Each kernel reads its operands from the source and target registers,
+ * performs a single operation with a fixed width and stores the result
+ * into the target register. They return 0 on success, or -1 if a fault
+ * was raised and the instruction shall be restarted.
+ */
+
+/* Kernels resolved for zeroed RARTH and RLGIC (no valid operation) */
+static int _alu_arth_bad_op(volatile void *from, volatile void *to);
+static int _alu_lgic_bad_op(volatile void *from, volatile void *to);
+
+/* A result stored into RARTH replaces the flags just computed */
+#define alu_flags_overwritten(to) \
+	if ((to) == (volatile void *) &regs.rarth) \
+		alu_flags.op = ALU_FLAGS_NONE
+
+struct alu_cache alu_cache = { 0, &_alu_arth_bad_op, &_alu_arth_bad_op, 0, &_alu_lgic_bad_op };
+
+static int _alu_arth_bad_width(volatile void *from, volatile void *to) {
+	alu_flags_sync();
+
+	fault_bad_reg_val(REG_RARTH, regs.rarth);
+	return -1;
+}
+
+static int _alu_arth_bad_op(volatile void *from, volatile void *to) {
+	/* Remove OF and UF bits if they're set */
+	alu_flags_clear();
+
+	fault_bad_reg_val(REG_RARTH, regs.rarth);
+	return -1;
+}
+
+#define ALU_ARTH_KERNEL(op, type) \
+static int _alu_arth_##op##_##type(volatile void *from, volatile void *to) { \
+	leg_##type##_t val1 = *(leg_##type##_t *) from, val2 = *(leg_##type##_t *) to; \
+	alu_flags_clear(); \
+	*(leg_##type##_t *) to = alu_##op##_##type(val1, val2); \
+	alu_flags_overwritten(to); \
+	return 0; \
+}
+
+#define ALU_ARTH_KERNEL_DIV(op, type) \
+static int _alu_arth_##op##_##type(volatile void *from, volatile void *to) { \
+	leg_##type##_t val1 = *(leg_##type##_t *) from, val2 = *(leg_##type##_t *) to; \
+	alu_flags_clear(); \
+	if (!val1) { \
+		fault_alu(); \
+		return -1; \
+	} \
+	*(leg_##type##_t *) to = alu_##op##_##type(val1, val2); \
+	alu_flags_overwritten(to); \
+	return 0; \
+}
+
+/* The reference arth() path falls through from the unsigned long MUL, SUB
+ * and ADD operations into the char ones with zeroed operands. Keep the
+ * flags they leave behind.
+ */
+#define ALU_ARTH_KERNEL_ULONG(op) \
+static int _alu_arth_##op##_ulong(volatile void *from, volatile void *to) { \
+	leg_ulong_t val1 = *(leg_ulong_t *) from, val2 = *(leg_ulong_t *) to; \
+	alu_flags_clear(); \
+	*(leg_ulong_t *) to = alu_##op##_ulong(val1, val2); \
+	alu_##op##_char(0, 0); \
+	alu_flags_overwritten(to); \
+	return 0; \
+}
+
+#define ALU_ARTH_KERNELS(type) \
+	ALU_ARTH_KERNEL(mul, type) \
+	ALU_ARTH_KERNEL_DIV(div, type) \
+	ALU_ARTH_KERNEL(sub, type) \
+	ALU_ARTH_KERNEL(add, type) \
+	ALU_ARTH_KERNEL_DIV(mod, type)
+
+ALU_ARTH_KERNELS(char)
+ALU_ARTH_KERNELS(uchar)
+ALU_ARTH_KERNELS(short)
+ALU_ARTH_KERNELS(ushort)
+ALU_ARTH_KERNELS(int)
+ALU_ARTH_KERNELS(uint)
+ALU_ARTH_KERNELS(long)
+ALU_ARTH_KERNEL_ULONG(mul)
+ALU_ARTH_KERNEL_DIV(div, ulong)
+ALU_ARTH_KERNEL_ULONG(sub)
+ALU_ARTH_KERNEL_ULONG(add)
+ALU_ARTH_KERNEL_DIV(mod, ulong)
+
+/* Floating point kernels. Operands are single precision, the double
+ * precision result has its most significant part stored at the extended
+ * operand register by the FPU.
+ */
+#define ALU_ARTH_KERNEL_FP(op, type) \
+static int _alu_arth_##op##_##type(volatile void *from, volatile void *to) { \
+	leg_float_t val1, val2; \
+	leg_##type##_t res; \
+	memcpy(&val1, (void *) from, 4); \
+	memcpy(&val2, (void *) to, 4); \
+	alu_flags_clear(); \
+	res = fpu_##op##_##type(val1, val2); \
+	memcpy((void *) to, &res, 4); \
+	return 0; \
+}
+
+#define ALU_ARTH_KERNEL_FP_DIV(op, type) \
+static int _alu_arth_##op##_##type(volatile void *from, volatile void *to) { \
+	leg_float_t val1, val2; \
+	leg_##type##_t res; \
+	memcpy(&val1, (void *) from, 4); \
+	memcpy(&val2, (void *) to, 4); \
+	alu_flags_clear(); \
+	if (!val1) { \
+		fault_fpu(); \
+		return -1; \
+	} \
+	res = fpu_##op##_##type(val1, val2); \
+	memcpy((void *) to, &res, 4); \
+	return 0; \
+}
+
+ALU_ARTH_KERNEL_FP(mul, float)
+ALU_ARTH_KERNEL_FP_DIV(div, float)
+ALU_ARTH_KERNEL_FP(sub, float)
+ALU_ARTH_KERNEL_FP(add, float)
+ALU_ARTH_KERNEL_FP(mul, double)
+ALU_ARTH_KERNEL_FP_DIV(div, double)
+ALU_ARTH_KERNEL_FP(sub, double)
+ALU_ARTH_KERNEL_FP(add, double)
+
+#define ALU_ARTH_ROW(type) { \
+	&_alu_arth_mul_##type, &_alu_arth_div_##type, &_alu_arth_sub_##type, \
+	&_alu_arth_add_##type, &_alu_arth_mod_##type }
+
+/* Indexed by width (signed 8, 16, 32, long, unsigned 8, 16, 32, long)
+ * and operation (MUL, DIV, SUB, ADD, MOD)
+ */
+static int (*const _alu_arth_int[8][5]) (volatile void *, volatile void *) = {
+	ALU_ARTH_ROW(char), ALU_ARTH_ROW(short), ALU_ARTH_ROW(int), ALU_ARTH_ROW(long),
+	ALU_ARTH_ROW(uchar), ALU_ARTH_ROW(ushort), ALU_ARTH_ROW(uint), ALU_ARTH_ROW(ulong)
+};
+
+/* Indexed by precision (single, double) and operation. No MOD on RFP. */
+static int (*const _alu_arth_fp[2][5]) (volatile void *, volatile void *) = {
+	{ &_alu_arth_mul_float, &_alu_arth_div_float, &_alu_arth_sub_float, &_alu_arth_add_float, &_alu_arth_bad_op },
+	{ &_alu_arth_mul_double, &_alu_arth_div_double, &_alu_arth_sub_double, &_alu_arth_add_double, &_alu_arth_bad_op }
+};
+
+void alu_arth_resolve(void) {
+	leg_addr_t rarth = regs.rarth & ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF);
+	int op, width;
+
+	alu_cache.rarth = rarth;
+
+	switch (rarth & (REG_ARTH_BIT_MUL | REG_ARTH_BIT_DIV | REG_ARTH_BIT_SUB |
+			REG_ARTH_BIT_ADD | REG_ARTH_BIT_MOD)) {
+		case REG_ARTH_BIT_MUL: op = 0; break;
+		case REG_ARTH_BIT_DIV: op = 1; break;
+		case REG_ARTH_BIT_SUB: op = 2; break;
+		case REG_ARTH_BIT_ADD: op = 3; break;
+		case REG_ARTH_BIT_MOD: op = 4; break;
+		default: op = -1;
+	}
+
+	/* Extended operand indicates double precision */
+	if (op < 0) {
+		alu_cache.arth_fp = &_alu_arth_bad_op;
+	} else {
+		alu_cache.arth_fp = _alu_arth_fp[!!(rarth & (REG_ARTH_BIT_ERFP1 | REG_ARTH_BIT_ERFP2 | REG_ARTH_BIT_ERFP3 | REG_ARTH_BIT_ERFP4))][op];
+	}
+
+	if (rarth & REG_ARTH_BIT_8BITOP) {
+		width = 0;
+	} else if (rarth & REG_ARTH_BIT_16BITOP) {
+		width = 1;
+	} else if (rarth & REG_ARTH_BIT_32BITOP) {
+#if ARCH_ADDR_BITS == 64
+		width = 2;
+#else
+		/* The operand width is validated before the operation */
+		alu_cache.arth = &_alu_arth_bad_width;
+		return;
+#endif
+	} else {
+		width = 3;
+	}
+
+	if (!(rarth & REG_ARTH_BIT_SIGNED))
+		width += 4;
+
+	alu_cache.arth = op < 0 ? &_alu_arth_bad_op : _alu_arth_int[width][op];
+}
+
+static int _alu_lgic_bad_width(volatile void *from, volatile void *to) {
+	/* Width fault, followed by the operation fault */
+	fault_bad_reg_val(REG_RLGIC, regs.rlgic);
+	fault_bad_reg_val(REG_RLGIC, regs.rlgic);
+	return -1;
+}
+
+static int _alu_lgic_bad_op(volatile void *from, volatile void *to) {
+	fault_bad_reg_val(REG_RLGIC, regs.rlgic);
+	return -1;
+}
+
+/* Two operand form of NOT for the kernel tables */
+#define ALU_NOT2(type) \
+static leg_##type##_t alu_not2_##type(leg_##type##_t from, leg_##type##_t to) { \
+	return alu_not_##type(from); \
+}
+
+ALU_NOT2(uchar)
+ALU_NOT2(ushort)
+ALU_NOT2(uint)
+ALU_NOT2(ulong)
+
+/* Logic kernels, with a variant that performs a NOT after the operation */
+#define ALU_LGIC_KERNEL(op, type) \
+static int _alu_lgic_##op##_##type(volatile void *from, volatile void *to) { \
+	*(leg_##type##_t *) to = alu_##op##_##type(*(leg_##type##_t *) from, *(leg_##type##_t *) to); \
+	return 0; \
+} \
+static int _alu_lgic_##op##_##type##_neg(volatile void *from, volatile void *to) { \
+	*(leg_##type##_t *) to = alu_not_##type(alu_##op##_##type(*(leg_##type##_t *) from, *(leg_##type##_t *) to)); \
+	return 0; \
+}
+
+#define ALU_LGIC_KERNELS(type) \
+	ALU_LGIC_KERNEL(not2, type) \
+	ALU_LGIC_KERNEL(xor, type) \
+	ALU_LGIC_KERNEL(and, type) \
+	ALU_LGIC_KERNEL(or, type) \
+	ALU_LGIC_KERNEL(shl, type) \
+	ALU_LGIC_KERNEL(shr, type) \
+	ALU_LGIC_KERNEL(rol, type)
+
+ALU_LGIC_KERNELS(uchar)
+ALU_LGIC_KERNELS(ushort)
+ALU_LGIC_KERNELS(uint)
+ALU_LGIC_KERNELS(ulong)
+
+#define ALU_LGIC_ROW(type, sfx) { \
+	&_alu_lgic_not2_##type##sfx, &_alu_lgic_xor_##type##sfx, &_alu_lgic_and_##type##sfx, \
+	&_alu_lgic_or_##type##sfx, &_alu_lgic_shl_##type##sfx, &_alu_lgic_shr_##type##sfx, \
+	&_alu_lgic_rol_##type##sfx }
+
+/* Indexed by negated result, width (8, 16, 32, long) and operation (NOT,
+ * XOR, AND, OR, SHL, SHR, ROL)
+ */
+static int (*const _alu_lgic[2][4][7]) (volatile void *, volatile void *) = {
+	{ ALU_LGIC_ROW(uchar, ), ALU_LGIC_ROW(ushort, ), ALU_LGIC_ROW(uint, ), ALU_LGIC_ROW(ulong, ) },
+	{ ALU_LGIC_ROW(uchar, _neg), ALU_LGIC_ROW(ushort, _neg), ALU_LGIC_ROW(uint, _neg), ALU_LGIC_ROW(ulong, _neg) }
+};
+
+void alu_lgic_resolve(void) {
+	leg_addr_t rlgic = regs.rlgic, trlgic = regs.rlgic;
+	int op, width, neg_res = 0;
+
+	alu_cache.rlgic = rlgic;
+
+	if (rlgic & REG_RLGIC_BIT_8BITOP) {
+		width = 0;
+	} else if (rlgic & REG_RLGIC_BIT_16BITOP) {
+		width = 1;
+	} else if (rlgic & REG_RLGIC_BIT_32BITOP) {
+#if ARCH_ADDR_BITS == 64
+		width = 2;
+#else
+		alu_cache.lgic = &_alu_lgic_bad_width;
+		return;
+#endif
+	} else {
+		width = 3;
+	}
+
+	/* Check if there are multiple (and valid) operations */
+	if ((rlgic & ~REG_RLGIC_BIT_NOT) && (rlgic & REG_RLGIC_BIT_NOT)) {
+		trlgic = rlgic & ~REG_RLGIC_BIT_NOT;
+		neg_res = 1;
+	}
+
+	/* NOTE: ROR is not part of the operation mask */
+	switch (trlgic & (REG_RLGIC_BIT_NOT | REG_RLGIC_BIT_XOR |
+			REG_RLGIC_BIT_AND | REG_RLGIC_BIT_OR |
+			REG_RLGIC_BIT_SHL | REG_RLGIC_BIT_SHR |
+			REG_RLGIC_BIT_ROL)) {
+		case REG_RLGIC_BIT_NOT: op = 0; break;
+		case REG_RLGIC_BIT_XOR: op = 1; break;
+		case REG_RLGIC_BIT_AND: op = 2; break;
+		case REG_RLGIC_BIT_OR: op = 3; break;
+		case REG_RLGIC_BIT_SHL: op = 4; break;
+		case REG_RLGIC_BIT_SHR: op = 5; break;
+		case REG_RLGIC_BIT_ROL: op = 6; break;
+		default:
+			alu_cache.lgic = &_alu_lgic_bad_op;
+			return;
+	}
+
+	alu_cache.lgic = _alu_lgic[neg_res][width][op];
+}
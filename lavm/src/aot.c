@@ -0,0 +1,190 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <dirent.h>
+
+#include <arpa/inet.h>
+
+#include "archdefs.h"
+#include "config.h"
+#include "aot.h"
+#include "decode.h"
+#include "mm.h"
+#include "run.h"
+#include "jit.h"
+
+struct aot aot;
+
+static int _aot_read_image(const char *file, struct aot_image *img) {
+	FILE *fp;
+	uint32_t i, *field;
+
+	if (!(fp = fopen(file, "rb")))
+		return -1;
+
+	if (fread(&img->hdr, sizeof(img->hdr), 1, fp) != 1)
+		goto _fail;
+
+	for (field = (uint32_t *) &img->hdr; field < (uint32_t *) (&img->hdr + 1); field++)
+		*field = ntohl(*field);
+
+	if ((img->hdr.magic != AOT_MAGIC) || (img->hdr.version != AOT_VERSION) || (img->hdr.stor_id >= HW_STOR_MAX))
+		goto _fail;
+
+	if (!img->hdr.count || (img->hdr.count > img->hdr.size))
+		goto _fail;
+
+	if (!(img->entry = malloc(img->hdr.count * sizeof(struct aot_entry))))
+		goto _fail;
+
+	if (fread(img->entry, sizeof(struct aot_entry), img->hdr.count, fp) != img->hdr.count) {
+		free(img->entry);
+		goto _fail;
+	}
+
+	for (i = 0; i < img->hdr.count; i++) {
+		img->entry[i].offset = ntohl(img->entry[i].offset);
+		img->entry[i].flags = ntohl(img->entry[i].flags);
+		img->entry[i].target = ntohl(img->entry[i].target);
+	}
+
+	fclose(fp);
+
+	return 0;
+
+_fail:
+	fclose(fp);
+
+	return -1;
+}
+
+/* Load the cache files of the VM at path. Returns the number of images. */
+int aot_init(const char *path) {
+	char tmp_path[PATH_MAX];
+	DIR *dp;
+	struct dirent *dent;
+	size_t len;
+
+	snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/" AOT_DIR, path);
+
+	/* The cache is optional */
+	if (!(dp = opendir(tmp_path)))
+		return 0;
+
+	while ((dent = readdir(dp)) && (aot.count < AOT_IMAGES_MAX)) {
+		len = strlen(dent->d_name);
+
+		if ((len <= strlen(AOT_SUFFIX)) || strcmp(dent->d_name + len - strlen(AOT_SUFFIX), AOT_SUFFIX))
+			continue;
+
+		snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/" AOT_DIR "/%s", path, dent->d_name);
+
+		/* Stale or corrupted files are ignored */
+		if (_aot_read_image(tmp_path, &aot.image[aot.count]) < 0)
+			continue;
+
+		aot.count++;
+	}
+
+	closedir(dp);
+
+	return aot.count;
+}
+
+/* Returns the first cached image from img on fully covered by a read of
+ * storage stor_id from offset into RAM at paddr, if its contents are
+ * unchanged, and sets base to its address. Returns NULL if there is none.
+ */
+static struct aot_image *_aot_match(struct aot_image *img, uint16_t stor_id, uint64_t offset, leg_addr_t size, leg_addr_t paddr, leg_addr_t *base) {
+	uint64_t hash;
+
+	for (; img < &aot.image[aot.count]; img++) {
+		if ((img->hdr.stor_id != stor_id) || (img->hdr.stor_offset < offset) || (((uint64_t) img->hdr.stor_offset + img->hdr.size) > (offset + size)))
+			continue;
+
+		*base = paddr + (img->hdr.stor_offset - offset);
+
+		/* Images are keyed by their contents */
+		hash = aot_hash(mm_ptr(*base), img->hdr.size);
+
+		if ((hash >> 32) != img->hdr.hash_hi || (uint32_t) hash != img->hdr.hash_lo)
+			continue;
+
+		return img;
+	}
+
+	return NULL;
+}
+
+/* Storage stor_id was read from offset into RAM at paddr. Decode any cached
+ * image fully covered by the read, if its contents are unchanged.
+ */
+void aot_load(uint16_t stor_id, uint64_t offset, leg_addr_t size, leg_addr_t paddr) {
+	struct aot_image *img;
+	leg_addr_t base, i;
+
+	for (img = aot.image; (img = _aot_match(img, stor_id, offset, size, paddr, &base)); img++) {
+		for (i = 0; i < img->hdr.count; i++) {
+			if (img->entry[i].offset >= img->hdr.size)
+				continue;
+
+			decode_prefetch(base + img->entry[i].offset);
+
+#if RUN_JIT
+			/* Compile local branch targets on their first privileged, unpaged run */
+			if ((config.vm.core == RUN_CORE_JIT) && (img->entry[i].flags & AOT_ENTRY_BRANCH) && (img->entry[i].target >= base) && (img->entry[i].target < (base + img->hdr.size)))
+				jit_hint(img->entry[i].target, 0);
+#endif
+		}
+
+#if RUN_JIT
+		if (config.vm.core == RUN_CORE_JIT)
+			jit_hint(base, 0);
+#endif
+	}
+}
+
+/* Same as aot_load(), but maps the pages of each image from the shared
+ * directory instead. Only boot images are shared, as other reads may hold
+ * private data.
+ */
+void aot_share(uint16_t stor_id, uint64_t offset, leg_addr_t size, leg_addr_t paddr) {
+	struct aot_image *img;
+	leg_addr_t base;
+
+	if (!config.vm.share)
+		return;
+
+	/* Best effort */
+	for (img = aot.image; (img = _aot_match(img, stor_id, offset, size, paddr, &base)); img++)
+		mm_share_image(base, img->hdr.size);
+}
+
+void aot_destroy(void) {
+	unsigned int i;
+
+	for (i = 0; i < aot.count; i++)
+		free(aot.image[i].entry);
+
+	aot.count = 0;
+}
+
@@ -0,0 +1,319 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "aot.h"
+
+#define ADDR_BOOT	0x000
+#define ADDR_KERNEL	0x800
+
+#define SIZE_BOOT	2048
+
+/* Instruction IDs with a literal branch target */
+#define INSN_JMP	0x06
+#define INSN_CALL	0x07
+
+/* Number of operands per instruction ID, starting at 0x01. Shall match the
+ * instruction table of the VM.
+ */
+static const uint8_t insn_operands[] = { 2, 2, 2, 2, 2, 1, 1, 0, 2, 2, 1, 2, 0 };
+
+struct cmdline {
+	const char *path;
+	FILE *fpstor;
+};
+
+static struct cmdline _cmdline = { NULL, NULL };
+
+static uint32_t image_word(const uint8_t *image, uint32_t offset) {
+	return ntohl(*(uint32_t *) &image[offset]);
+}
+
+/* Linear sweep of the image. Instructions are 32-bit aligned, so data that
+ * doesn't decode is skipped a word at a time. The VM decodes each entry
+ * again when loading, so a misplaced entry costs nothing but a cache slot.
+ */
+static uint32_t image_translate(const uint8_t *image, uint32_t size, struct aot_entry *entry) {
+	uint32_t offset = 0, count = 0, opcode, isize;
+	uint8_t id;
+
+	while ((offset + 4) <= size) {
+		opcode = image_word(image, offset);
+		id = opcode & 0xFF;
+
+		if (!id || (id > sizeof(insn_operands))) {
+			offset += 4;
+			continue;
+		}
+
+		isize = 4;
+
+		if (!(opcode & 0xFF00) && (insn_operands[id - 1] > 0))
+			isize += 4;
+
+		if (!(opcode & 0xFF0000) && (insn_operands[id - 1] > 1))
+			isize += 4;
+
+		if ((offset + isize) > size)
+			break;
+
+		entry[count].offset = htonl(offset);
+		entry[count].flags = 0;
+		entry[count].target = 0;
+
+		if (((id == INSN_JMP) || (id == INSN_CALL)) && !(opcode & 0xFF00)) {
+			entry[count].flags = htonl(AOT_ENTRY_BRANCH);
+			entry[count].target = htonl(image_word(image, offset + 4));
+		}
+
+		count++;
+		offset += isize;
+	}
+
+	return count;
+}
+
+static int image_write(const char *name, const uint8_t *image, uint32_t stor_offset, uint32_t size) {
+	char file[PATH_MAX];
+	struct aot_header hdr;
+	struct aot_entry *entry;
+	uint64_t hash = aot_hash(image, size);
+	uint32_t count;
+	FILE *fp;
+
+	if (!(entry = malloc((size / 4 + 1) * sizeof(struct aot_entry)))) {
+		printf("malloc(): %m\n");
+		return -1;
+	}
+
+	if (!(count = image_translate(image, size, entry))) {
+		printf("%s: no instructions found.\n", name);
+		free(entry);
+		return 0;
+	}
+
+	hdr.magic = htonl(AOT_MAGIC);
+	hdr.version = htonl(AOT_VERSION);
+	hdr.stor_id = htonl(0);
+	hdr.stor_offset = htonl(stor_offset);
+	hdr.size = htonl(size);
+	hdr.hash_hi = htonl(hash >> 32);
+	hdr.hash_lo = htonl((uint32_t) hash);
+	hdr.count = htonl(count);
+
+	snprintf(file, sizeof(file) - 1, "%s/" AOT_DIR "/%.16llx" AOT_SUFFIX, _cmdline.path, (unsigned long long) hash);
+
+	printf("%s: %u bytes, %u instructions, hash 0x%.16llX\n", name, size, count, (unsigned long long) hash);
+	printf("Writing %s...\n", file);
+
+	if (!(fp = fopen(file, "wb"))) {
+		printf("Unable to open file '%s' for writing: %m\n", file);
+		free(entry);
+		return -1;
+	}
+
+	if ((fwrite(&hdr, sizeof(hdr), 1, fp) != 1) || (fwrite(entry, sizeof(struct aot_entry), count, fp) != count)) {
+		printf("Write failed: %m\n");
+		fclose(fp);
+		free(entry);
+		return -1;
+	}
+
+	fclose(fp);
+	free(entry);
+
+	return 0;
+}
+
+static int aot_clean(void) {
+	char tmp_path[PATH_MAX];
+	DIR *dp;
+	struct dirent *dent;
+	size_t len;
+
+	snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/" AOT_DIR, _cmdline.path);
+
+	if ((mkdir(tmp_path, 0755) < 0) && (errno != EEXIST)) {
+		printf("Unable to create directory '%s': %m\n", tmp_path);
+		return -1;
+	}
+
+	if (!(dp = opendir(tmp_path))) {
+		printf("Unable to read directory '%s': %m\n", tmp_path);
+		return -1;
+	}
+
+	/* Drop the translations of previously installed images */
+	while ((dent = readdir(dp))) {
+		len = strlen(dent->d_name);
+
+		if ((len <= strlen(AOT_SUFFIX)) || strcmp(dent->d_name + len - strlen(AOT_SUFFIX), AOT_SUFFIX))
+			continue;
+
+		snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/" AOT_DIR "/%s", _cmdline.path, dent->d_name);
+
+		unlink(tmp_path);
+	}
+
+	closedir(dp);
+
+	return 0;
+}
+
+static int translate(FILE *fpstor) {
+	uint8_t *image;
+	uint32_t ksize;
+
+	if (aot_clean() < 0)
+		return -1;
+
+	/* Bootloader is always loaded in full */
+	if (!(image = calloc(1, SIZE_BOOT))) {
+		printf("calloc(): %m\n");
+		return -1;
+	}
+
+	if ((fseek(fpstor, ADDR_BOOT, SEEK_SET) < 0) || (fread(image, 1, SIZE_BOOT, fpstor) != SIZE_BOOT)) {
+		printf("Unable to read Bootloader: %m\n");
+		free(image);
+		return -1;
+	}
+
+	if (image_write("Bootloader", image, ADDR_BOOT, SIZE_BOOT) < 0) {
+		free(image);
+		return -1;
+	}
+
+	free(image);
+
+	/* Kernel is prefixed by its 32-bit size */
+	if ((fseek(fpstor, ADDR_KERNEL, SEEK_SET) < 0) || (fread(&ksize, 4, 1, fpstor) != 1) || !(ksize = ntohl(ksize))) {
+		puts("Kernel: not installed.");
+		return 0;
+	}
+
+	if (!(image = malloc(ksize))) {
+		printf("malloc(): %m\n");
+		return -1;
+	}
+
+	if (fread(image, 1, ksize, fpstor) != ksize) {
+		printf("Unable to read Kernel (%u bytes)\n", ksize);
+		free(image);
+		return -1;
+	}
+
+	if (image_write("Kernel", image, ADDR_KERNEL + 4, ksize) < 0) {
+		free(image);
+		return -1;
+	}
+
+	free(image);
+
+	return 0;
+}
+
+static FILE *storage_open(const char *path) {
+	char tmp_path[PATH_MAX];
+	DIR *dp;
+	struct dirent *dent;
+	FILE *fp = NULL;
+
+	snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/storage", path);
+
+	if (!(dp = opendir(tmp_path))) {
+		printf("Unable to read directory '%s': %m\n", tmp_path);
+		return NULL;
+	}
+
+	/* Images are installed on storage ID 0 */
+	while ((dent = readdir(dp))) {
+		if (!strstr(dent->d_name, "storage") || !isdigit(dent->d_name[0]) || atoi(dent->d_name))
+			continue;
+
+		/* Overlays are translated from their base image. Images the VM
+		 * has since changed don't match their hash and aren't loaded.
+		 */
+		snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/storage/%.*sbase", path, (int) (strstr(dent->d_name, "storage") - dent->d_name), dent->d_name);
+
+		if (access(tmp_path, F_OK) < 0)
+			snprintf(tmp_path, sizeof(tmp_path) - 1, "%s/storage/%s", path, dent->d_name);
+
+		if (!(fp = fopen(tmp_path, "rb")))
+			printf("Unable to open file '%s' for reading: %m\n", tmp_path);
+
+		break;
+	}
+
+	closedir(dp);
+
+	return fp;
+}
+
+static void usage(char **argv) {
+	printf("Usage: %s <vm config dir>\n\n", argv[0]);
+	puts("Translates the bootloader and kernel installed on storage ID 0 and");
+	puts("stores the result under <vm config dir>/" AOT_DIR ", where the VM loads it at boot.");
+	puts("Run it again whenever a new image is installed.\n");
+}
+
+static void syntax(int argc, char **argv, struct cmdline *cmdline) {
+	if (argc != 2) {
+		usage(argv);
+		exit(EXIT_FAILURE);
+	}
+
+	cmdline->path = argv[1];
+
+	if (!(cmdline->fpstor = storage_open(argv[1]))) {
+		printf("Unable to find storage ID 0 in '%s'\n", argv[1]);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void destroy(struct cmdline *cmdline) {
+	fclose(cmdline->fpstor);
+}
+
+int main(int argc, char *argv[]) {
+	syntax(argc, argv, &_cmdline);
+
+	if (translate(_cmdline.fpstor) < 0) {
+		puts("Translation failed.");
+		exit(EXIT_FAILURE);
+	}
+
+	puts("Done.");
+
+	destroy(&_cmdline);
+
+	return 0;
+}
+
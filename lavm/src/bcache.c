@@ -0,0 +1,319 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "archdefs.h"
+#include "config.h"
+#include "bcache.h"
+#include "io.h"
+#include "mm.h"
+
+struct bcache bcache;
+
+static struct bcache_block **_bcache_bucket(uint16_t storid, uint64_t index) {
+	uint64_t key = (index ^ ((uint64_t) storid << 48)) * 0x9E3779B97F4A7C15ULL;
+
+	return &bcache.hash[(key >> 32) & bcache.hash_mask];
+}
+
+static uint8_t *_bcache_data(struct bcache_block *b) {
+	return bcache.data + (b - bcache.block) * bcache.size;
+}
+
+static struct bcache_block *_bcache_lookup(uint16_t storid, uint64_t index) {
+	struct bcache_block *b;
+
+	for (b = *_bcache_bucket(storid, index); b; b = b->next) {
+		if ((b->index == index) && (b->storid == storid))
+			return b;
+	}
+
+	return NULL;
+}
+
+static void _bcache_unlink(struct bcache_block *b) {
+	struct bcache_block **p;
+
+	for (p = _bcache_bucket(b->storid, b->index); *p != b; p = &(*p)->next);
+
+	*p = b->next;
+	b->valid = 0;
+}
+
+static int _bcache_writeback(struct bcache_block *b) {
+	if (!b->dirty)
+		return 0;
+
+	if (io_storage_pwrite(b->storid, _bcache_data(b), b->len, b->index * bcache.size) != b->len)
+		return -1;
+
+	b->dirty = 0;
+	bcache.writebacks++;
+
+	return 0;
+}
+
+/* Free a block, sweeping the clock hand past recently used ones. Returns
+ * NULL if the victim couldn't be written back.
+ */
+static struct bcache_block *_bcache_evict(void) {
+	struct bcache_block *b;
+
+	for (;;) {
+		b = &bcache.block[bcache.hand];
+		bcache.hand = (bcache.hand + 1) % bcache.count;
+
+		if (!b->valid)
+			return b;
+
+		if (b->ref) {
+			b->ref = 0;
+			continue;
+		}
+
+		if (_bcache_writeback(b) < 0)
+			return NULL;
+
+		_bcache_unlink(b);
+
+		return b;
+	}
+}
+
+/* Returns the cached block, reading it from storage if load is set */
+static struct bcache_block *_bcache_get(uint16_t storid, uint64_t index, int load) {
+	struct bcache_block *b, **bucket;
+	ssize_t len = 0;
+
+	if ((b = _bcache_lookup(storid, index))) {
+		bcache.hits++;
+		b->ref = 1;
+		return b;
+	}
+
+	bcache.misses++;
+
+	if (!(b = _bcache_evict()))
+		return NULL;
+
+	if (load && ((len = io_storage_pread(storid, _bcache_data(b), bcache.size, index * bcache.size)) < 0))
+		return NULL;
+
+	bucket = _bcache_bucket(storid, index);
+
+	b->index = index;
+	b->storid = storid;
+	b->len = len;
+	b->valid = 1;
+	b->dirty = 0;
+	b->ref = 1;
+	b->next = *bucket;
+	*bucket = b;
+
+	return b;
+}
+
+/* Blocks a storage window maps would go stale, so their range is never cached */
+static int _bcache_windowed(uint16_t storid, uint64_t offset, size_t size) {
+	uint64_t start = (offset / bcache.size) * bcache.size;
+	uint64_t end = ((offset + size + bcache.size - 1) / bcache.size) * bcache.size;
+
+	return mm_window_mapped(io.fdstor[storid], start, end - start);
+}
+
+/* Faults exit without vm_destroy(). Stores shall still reach storage. */
+static void _bcache_exit(void) {
+	bcache_flush();
+}
+
+/* Returns the number of blocks, 0 if the cache isn't configured */
+int bcache_init(void) {
+	size_t buckets = 1;
+
+	if (!config.vm.cache)
+		return 0;
+
+	bcache.size = config.vm.cache_block ? config.vm.cache_block : BCACHE_BLOCK_SIZE;
+
+	if ((bcache.size < 512) || (bcache.size & (bcache.size - 1)))
+		return -1;
+
+	while (buckets < config.vm.cache)
+		buckets <<= 1;
+
+	if (!(bcache.block = calloc(config.vm.cache, sizeof(struct bcache_block))))
+		return -1;
+
+	if (!(bcache.hash = calloc(buckets, sizeof(struct bcache_block *))))
+		goto _fail;
+
+	if (!(bcache.data = malloc((size_t) config.vm.cache * bcache.size)))
+		goto _fail;
+
+	bcache.count = config.vm.cache;
+	bcache.hash_mask = buckets - 1;
+
+	atexit(&_bcache_exit);
+
+	return bcache.count;
+
+_fail:
+	free(bcache.hash);
+	free(bcache.block);
+
+	memset(&bcache, 0, sizeof(bcache));
+
+	return -1;
+}
+
+/* Same semantics as pread() */
+ssize_t bcache_read(uint16_t storid, void *buf, size_t size, uint64_t offset) {
+	struct bcache_block *b;
+	size_t off, part, done = 0;
+
+	if (!bcache.count || (size > (BCACHE_BYPASS_BLOCKS * bcache.size)) || _bcache_windowed(storid, offset, size)) {
+		if (bcache_sync(storid, offset, size, 0) < 0)
+			return -1;
+
+		return io_storage_pread(storid, buf, size, offset);
+	}
+
+	while (done < size) {
+		off = (offset + done) % bcache.size;
+		part = bcache.size - off < size - done ? bcache.size - off : size - done;
+
+		if (!(b = _bcache_get(storid, (offset + done) / bcache.size, 1)))
+			return done ? done : -1;
+
+		/* End of storage */
+		if (off >= b->len)
+			break;
+
+		if (part > b->len - off)
+			part = b->len - off;
+
+		memcpy((uint8_t *) buf + done, _bcache_data(b) + off, part);
+		done += part;
+
+		if ((off + part) < bcache.size)
+			break;
+	}
+
+	return done;
+}
+
+/* Same semantics as pwrite(), but stores reach storage when written back */
+ssize_t bcache_write(uint16_t storid, const void *buf, size_t size, uint64_t offset) {
+	struct bcache_block *b;
+	size_t off, part, done = 0;
+
+	if (!bcache.count || (size > (BCACHE_BYPASS_BLOCKS * bcache.size)) || _bcache_windowed(storid, offset, size)) {
+		if (bcache_sync(storid, offset, size, 1) < 0)
+			return -1;
+
+		return io_storage_pwrite(storid, buf, size, offset);
+	}
+
+	while (done < size) {
+		off = (offset + done) % bcache.size;
+		part = bcache.size - off < size - done ? bcache.size - off : size - done;
+
+		/* Whole blocks aren't read before being overwritten */
+		if (!(b = _bcache_get(storid, (offset + done) / bcache.size, part != bcache.size)))
+			return -1;
+
+		/* Storing past the end of storage leaves a zeroed gap */
+		if (off > b->len)
+			memset(_bcache_data(b) + b->len, 0, off - b->len);
+
+		memcpy(_bcache_data(b) + off, (const uint8_t *) buf + done, part);
+
+		if ((off + part) > b->len)
+			b->len = off + part;
+
+		b->dirty = 1;
+		done += part;
+	}
+
+	return done;
+}
+
+/* Write back the cached blocks of a range about to be accessed directly, and
+ * drop them if it is about to be written.
+ */
+int bcache_sync(uint16_t storid, uint64_t offset, size_t size, int invalidate) {
+	struct bcache_block *b;
+	uint64_t index;
+
+	if (!bcache.count || !size)
+		return 0;
+
+	for (index = offset / bcache.size; index <= (offset + size - 1) / bcache.size; index++) {
+		if (!(b = _bcache_lookup(storid, index)))
+			continue;
+
+		if (_bcache_writeback(b) < 0)
+			return -1;
+
+		if (invalidate)
+			_bcache_unlink(b);
+	}
+
+	return 0;
+}
+
+int bcache_flush(void) {
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < bcache.count; i++) {
+		if (bcache.block[i].valid && (_bcache_writeback(&bcache.block[i]) < 0))
+			ret = -1;
+	}
+
+	return ret;
+}
+
+void bcache_stats(void) {
+	uint64_t total = bcache.hits + bcache.misses;
+
+	if (!bcache.count)
+		return;
+
+	printf("Block cache: %llu hits, %llu misses (%.1f%% hit rate), %llu write-backs\n",
+		(unsigned long long) bcache.hits, (unsigned long long) bcache.misses,
+		total ? (bcache.hits * 100.0) / total : 0.0, (unsigned long long) bcache.writebacks);
+}
+
+void bcache_destroy(void) {
+	if (!bcache.count)
+		return;
+
+	if (bcache_flush() < 0)
+		puts("Block cache: failed to write back to storage.");
+
+	free(bcache.data);
+	free(bcache.hash);
+	free(bcache.block);
+
+	memset(&bcache, 0, sizeof(bcache));
+}
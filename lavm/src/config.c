@@ -27,6 +27,8 @@
 
 #include "archdefs.h"
 #include "config.h"
+#include "run.h"
+#include "mm.h"
 
 struct config config = { { 0, { [ 0 ... HW_STOR_MAX - 1 ] = NULL  } } };
 
@@ -105,11 +107,203 @@ static void _config_scan_ram(const char *path) {
 	}
 }
 
+static void _config_scan_core(const char *path) {
+	char tmp_path[_POSIX_PATH_MAX];
+	char coreval[32];
+	FILE *fp;
+
+	/* Craft temporary path */
+	sprintf(tmp_path, "%s/core", path);
+
+	/* Core configuration is optional */
+	if (!(fp = fopen(tmp_path, "r"))) {
+		config.vm.core = RUN_CORE_DEFAULT;
+		return;
+	}
+
+	/* Read core configuration file contents */
+	if (!fgets(coreval, sizeof(coreval) - 1, fp)) {
+		printf("Core configuration file is empty.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Close file pointer */
+	fclose(fp);
+
+	/* Load core configuration */
+	if (!strncmp(coreval, "table", 5)) {
+		config.vm.core = RUN_CORE_TABLE;
+	} else if (!strncmp(coreval, "threaded", 8)) {
+		config.vm.core = RUN_CORE_THREADED;
+	} else if (!strncmp(coreval, "jit", 3)) {
+		config.vm.core = RUN_CORE_JIT;
+	} else {
+		printf("Invalid core configuration: %s\n", coreval);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void _config_scan_mm(const char *path) {
+	char tmp_path[_POSIX_PATH_MAX];
+	char mmval[128], *opt, *saveptr = NULL;
+	FILE *fp;
+
+	/* Craft temporary path */
+	sprintf(tmp_path, "%s/mm", path);
+
+	/* RAM options are optional */
+	if (!(fp = fopen(tmp_path, "r")))
+		return;
+
+	/* Read RAM options file contents */
+	if (!fgets(mmval, sizeof(mmval) - 1, fp)) {
+		printf("RAM options file is empty.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Close file pointer */
+	fclose(fp);
+
+	/* Load RAM options */
+	for (opt = strtok_r(mmval, " ,\t\r\n", &saveptr); opt; opt = strtok_r(NULL, " ,\t\r\n", &saveptr)) {
+		if (!strcmp(opt, "hugetlb")) {
+			config.vm.mm |= MM_OPT_HUGETLB;
+		} else if (!strcmp(opt, "thp")) {
+			config.vm.mm |= MM_OPT_THP;
+		} else if (!strcmp(opt, "populate")) {
+			config.vm.mm |= MM_OPT_POPULATE;
+		} else if (!strcmp(opt, "noreserve")) {
+			config.vm.mm |= MM_OPT_NORESERVE;
+		} else if (!strcmp(opt, "merge")) {
+			config.vm.mm |= MM_OPT_MERGE;
+		} else if (!strcmp(opt, "dirty")) {
+			config.vm.mm |= MM_OPT_DIRTY;
+		} else if (!strncmp(opt, "dirty=", 6)) {
+			config.vm.mm |= MM_OPT_DIRTY;
+			config.vm.dirty = strtoul(opt + 6, NULL, 0);
+		} else {
+			printf("Invalid RAM option: %s\n", opt);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+static void _config_scan_watch(const char *path) {
+	char tmp_path[_POSIX_PATH_MAX];
+	char watchval[128], action[16];
+	long addr, size;
+	struct config_watch *w;
+	FILE *fp;
+	int n;
+
+	/* Craft temporary path */
+	sprintf(tmp_path, "%s/watch", path);
+
+	/* Watchpoints are optional */
+	if (!(fp = fopen(tmp_path, "r")))
+		return;
+
+	/* One watchpoint per line: <address> <size> [log|pause] */
+	while (fgets(watchval, sizeof(watchval) - 1, fp)) {
+		if (((n = sscanf(watchval, "%li %li %15s", &addr, &size, action)) < 2) || (addr < 0) || (size <= 0) || (addr > 0xFFFFFFFFL) || (((uint64_t) addr + size) > 0x100000000ULL)) {
+			/* Skip blank lines */
+			if (n < 0)
+				continue;
+
+			printf("Invalid watchpoint: %s\n", watchval);
+			exit(EXIT_FAILURE);
+		}
+
+		if (config.vm.watch_count >= CONFIG_WATCH_MAX) {
+			printf("Too many watchpoints, the maximum is %d.\n", CONFIG_WATCH_MAX);
+			exit(EXIT_FAILURE);
+		}
+
+		w = &config.vm.watch[config.vm.watch_count++];
+
+		w->addr = addr;
+		w->size = size;
+
+		if ((n == 3) && !strcmp(action, "pause")) {
+			w->pause = 1;
+		} else if ((n == 3) && strcmp(action, "log")) {
+			printf("Invalid watchpoint action: %s\n", action);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/* Close file pointer */
+	fclose(fp);
+}
+
+static void _config_scan_share(const char *path) {
+	char tmp_path[_POSIX_PATH_MAX];
+	char shareval[_POSIX_PATH_MAX];
+	FILE *fp;
+
+	/* Craft temporary path */
+	sprintf(tmp_path, "%s/share", path);
+
+	/* Shared images are optional */
+	if (!(fp = fopen(tmp_path, "r")))
+		return;
+
+	/* Read shared directory path */
+	if (!fgets(shareval, sizeof(shareval) - 1, fp)) {
+		printf("Shared images configuration file is empty.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Close file pointer */
+	fclose(fp);
+
+	shareval[strcspn(shareval, "\r\n")] = 0;
+
+	/* Load shared directory path */
+	if (!(config.vm.share = malloc(strlen(shareval) + 1))) {
+		printf("Unable to load shared images configuration: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(config.vm.share, shareval);
+}
+
+static void _config_scan_cache(const char *path) {
+	char tmp_path[_POSIX_PATH_MAX];
+	char cacheval[64];
+	unsigned long blocks, size = 0;
+	FILE *fp;
+
+	/* Craft temporary path */
+	sprintf(tmp_path, "%s/cache", path);
+
+	/* Storage block cache is optional */
+	if (!(fp = fopen(tmp_path, "r")))
+		return;
+
+	/* Read storage block cache configuration: <blocks> [<block size>] */
+	if (!fgets(cacheval, sizeof(cacheval) - 1, fp) || (sscanf(cacheval, "%lu %lu", &blocks, &size) < 1) || !blocks) {
+		printf("Invalid storage block cache configuration.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* Close file pointer */
+	fclose(fp);
+
+	config.vm.cache = blocks;
+	config.vm.cache_block = size;
+}
+
 void config_init(const char *path) {
 	memset(&config, 0, sizeof(struct config));
 
 	_config_scan_storage(path);
 	_config_scan_ram(path);
+	_config_scan_core(path);
+	_config_scan_mm(path);
+	_config_scan_watch(path);
+	_config_scan_share(path);
+	_config_scan_cache(path);
 }
 
 void config_destroy(void) {
@@ -119,5 +313,7 @@ void config_destroy(void) {
 		if (config.vm.stor[i])
 			free(config.vm.stor[i]);
 	}
+
+	free(config.vm.share);
 }
 
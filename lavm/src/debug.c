@@ -19,8 +19,6 @@
 #include <string.h>
 #include <stdint.h>
 
-#include <arpa/inet.h>
-
 #include "archdefs.h"
 #include "config.h"
 #include "register.h"
@@ -150,7 +148,7 @@ int debug_instruction_enter(
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				"(0x%.8X) = 0x%.8X",
 				so,
-				ntohl(*(leg_addr_t *) ((char *) mm + so)));
+				mm_load_addr(so));
 		} else {
 			/* Grant normal zone and check ram boundaries */
 			if (!mm_grant_zone_normal(so)) {
@@ -161,7 +159,7 @@ int debug_instruction_enter(
 
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				" = 0x%.8X",
-				ntohl(*(leg_addr_t *) ((char *) mm + so)));
+				mm_load_addr(so));
 		}
 	} else if (sond_type == OPERAND_TYPE_LIT) {
 		/* Operand is a literal */
@@ -217,7 +215,7 @@ int debug_instruction_enter(
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				"(0x%.8X) = 0x%.8X",
 				to,
-				ntohl(*(leg_addr_t *) ((char *) mm + to)));
+				mm_load_addr(to));
 		} else {
 			/* Grant normal zone and check ram boundaries */
 			if (!mm_grant_zone_normal(to)) {
@@ -228,7 +226,7 @@ int debug_instruction_enter(
 
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				" = 0x%.8X",
-				ntohl(*(leg_addr_t *) ((char *) mm + to)));
+				mm_load_addr(to));
 		}
 	}
 
@@ -302,7 +300,7 @@ int debug_instruction_leave(
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				"(0x%.8X) = 0x%.8X",
 				so,
-				ntohl(*(leg_addr_t *) ((char *) mm + so)));
+				mm_load_addr(so));
 		} else {
 			/* Grant normal zone and check ram boundaries */
 			if (!mm_grant_zone_normal(so)) {
@@ -313,7 +311,7 @@ int debug_instruction_leave(
 
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				" = 0x%.8X",
-				ntohl(*(leg_addr_t *) ((char *) mm + so)));
+				mm_load_addr(so));
 		}
 	} else if (sond_type == OPERAND_TYPE_LIT) {
 		/* Operand is a literal */
@@ -368,7 +366,7 @@ int debug_instruction_leave(
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				"(0x%.8X) = 0x%.8X",
 				to,
-				ntohl(*(leg_addr_t *) ((char *) mm + to)));
+				mm_load_addr(to));
 		} else {
 			/* Grant normal zone and check ram boundaries */
 			if (!mm_grant_zone_normal(to)) {
@@ -380,7 +378,7 @@ int debug_instruction_leave(
 
 			snprintf(dbgstr_partial, sizeof(dbgstr_partial) - 1,
 				" = 0x%.8X",
-				ntohl(*(leg_addr_t *) ((char *) mm + to)));
+				mm_load_addr(to));
 		}
 	}
 
@@ -0,0 +1,253 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "archdefs.h"
+#include "config.h"
+#include "instruction.h"
+#include "decode.h"
+#include "fault.h"
+#include "mm.h"
+#include "run.h"
+#include "jit.h"
+#include "paging.h"
+
+struct decode_cache dcache;
+
+static void _decode_map_set(leg_addr_t addr) {
+	dcache.map[addr >> (DECODE_BLOCK_SHIFT + 3)] |= 1 << ((addr >> DECODE_BLOCK_SHIFT) & 7);
+}
+
+static void _decode_map_clear(leg_addr_t addr) {
+	dcache.map[addr >> (DECODE_BLOCK_SHIFT + 3)] &= ~(1 << ((addr >> DECODE_BLOCK_SHIFT) & 7));
+}
+
+/* Grant that addr is in the normal zone. Peeks must not raise faults. */
+static int _decode_grant(leg_addr_t addr, int peek) {
+	if (peek)
+		return (addr >= MM_ZONE_NORMAL) && (addr < config.vm.ram);
+
+	return mm_grant_zone_normal(addr);
+}
+
+static int _decode_parse(leg_addr_t prip, struct decode *d, int peek) {
+	uint32_t opcode;
+	leg_addr_t opcode_oper1, opcode_oper2;
+	uint8_t opcode_size = 0, opcode_id;
+	uint8_t operand1_type = OPERAND_TYPE_REG, operand2_type = OPERAND_TYPE_REG;
+
+	/* Sanity check - Check normal zone and RAM boundaries */
+	if (!_decode_grant(prip, peek))
+		return -1;
+
+	/* Extract opcode */
+	opcode = mm_load32(prip);
+
+	if (!peek)
+		run.opcode = opcode;
+
+	/* Extract instruction id and respective operands */
+	opcode_size += ARCH_ADDR_BITS >> 3;
+	opcode_id = opcode & 0xFF;
+	opcode_oper1 = (opcode & 0xFF00) >> 8;
+	opcode_oper2 = (opcode & 0xFF0000) >> 16;
+
+	/* Another sanity check */
+	if (!opcode_id || (opcode_id >= INSTRUCTION_SET_SIZE)) {
+		if (!peek)
+			fault_illegal_instruction();
+
+		return -1;
+	}
+
+	/* Evaluate the opcode structure and properly set the operands */
+	if (!opcode_oper2 && (instruction[opcode_id - 1].size > 1)) {
+		/* Check if we're not out of RAM bondaries */
+		if (!_decode_grant(prip + (ARCH_ADDR_BITS >> (3 - !opcode_oper1)), peek))
+			return -1;
+
+		opcode_oper2 = mm_load_addr(prip + (ARCH_ADDR_BITS >> (3 - !opcode_oper1)));
+
+		opcode_size += (ARCH_ADDR_BITS >> 3);
+
+		operand2_type = OPERAND_TYPE_LIT;
+	}
+
+	if (!opcode_oper1 && (instruction[opcode_id - 1].size > 0)) {
+		/* Check if we're not out of RAM bondaries */
+		if (!_decode_grant(prip + (ARCH_ADDR_BITS >> 3), peek))
+			return -1;
+
+		opcode_oper1 = mm_load_addr(prip + (ARCH_ADDR_BITS >> 3));
+
+		opcode_size += (ARCH_ADDR_BITS >> 3);
+
+		operand1_type = OPERAND_TYPE_LIT;
+	}
+
+	/* Store the decoded instruction */
+	d->paddr = prip;
+	d->opcode = opcode;
+	d->oper1 = opcode_oper1;
+	d->oper2 = opcode_oper2;
+	d->size = opcode_size;
+	d->id = opcode_id;
+	d->oper1_type = operand1_type;
+	d->oper2_type = operand2_type;
+	d->fused = 0;
+	d->span = opcode_size;
+
+	/* Select the handler variant for these operands */
+	instruction_specialize(d);
+
+	return 0;
+}
+
+static struct decode *_decode_insert(leg_addr_t prip, int peek) {
+	struct decode *d = &dcache.entry[(prip >> 2) & (DECODE_CACHE_SIZE - 1)];
+
+	/* Decode the instruction, replacing any previous entry */
+	if (_decode_parse(prip, d, peek) < 0)
+		return NULL;
+
+	/* Merge it with the instructions that follow, if they form an idiom */
+	instruction_fuse(d);
+
+	/* Track the code blocks covered by this instruction */
+	_decode_map_set(prip);
+	_decode_map_set(prip + d->span - 1);
+
+	return d;
+}
+
+struct decode *decode_fetch(leg_addr_t prip) {
+	return _decode_insert(prip, 0);
+}
+
+/* Cache the instruction at prip ahead of its execution, without raising
+ * faults. Returns -1 if it would fault when fetched.
+ */
+int decode_prefetch(leg_addr_t prip) {
+	struct decode *d;
+
+	if (!(d = _decode_insert(prip, 1)))
+		return -1;
+
+	/* Bound to its handler by the threaded core on first dispatch */
+	d->thread = NULL;
+
+	return 0;
+}
+
+/* Mark a range holding code cached elsewhere (i.e. compiled blocks), so
+ * writes to it are reported to decode_invalidate().
+ */
+void decode_track(leg_addr_t addr, leg_addr_t size) {
+	uint64_t blk;
+
+	for (blk = addr >> DECODE_BLOCK_SHIFT; blk <= (((uint64_t) addr + size - 1) >> DECODE_BLOCK_SHIFT); blk++)
+		_decode_map_set(blk << DECODE_BLOCK_SHIFT);
+}
+
+/* Decode the instruction at prip into d without raising faults nor touching
+ * the cache. Returns -1 if it would fault when fetched.
+ */
+int decode_peek(leg_addr_t prip, struct decode *d) {
+	return _decode_parse(prip, d, 1);
+}
+
+void decode_invalidate(leg_addr_t addr, leg_addr_t size) {
+	uint64_t start, end, blk;
+	struct decode *d;
+	int hit = 0;
+
+	if (!size)
+		return;
+
+	/* Lowest address of an instruction that may overlap the range */
+	start = addr > DECODE_SPAN_MAX ? addr - (DECODE_SPAN_MAX - 1) : 0;
+	end = (uint64_t) addr + size;
+
+	/* Skip ranges with no cached code */
+	for (blk = start >> DECODE_BLOCK_SHIFT; blk <= ((end - 1) >> DECODE_BLOCK_SHIFT); blk++) {
+		if (decode_map_test(blk << DECODE_BLOCK_SHIFT)) {
+			hit = 1;
+			break;
+		}
+	}
+
+	if (!hit)
+		return;
+
+#if RUN_JIT
+	/* Compiled blocks may overlap the range */
+	jit_invalidate(addr, size);
+#endif
+
+	if (((end - 1) >> 2) - (start >> 2) < DECODE_CACHE_SIZE) {
+		/* Probe only the entries that may hold addresses in range */
+		for (blk = start >> 2; blk <= ((end - 1) >> 2); blk++) {
+			d = &dcache.entry[blk & (DECODE_CACHE_SIZE - 1)];
+
+			if (d->size && (d->paddr < end) && (((uint64_t) d->paddr + d->span) > addr))
+				d->size = 0;
+		}
+	} else {
+		/* Large range: scan the whole cache */
+		for (d = dcache.entry; d < &dcache.entry[DECODE_CACHE_SIZE]; d++) {
+			if (d->size && (d->paddr < end) && (((uint64_t) d->paddr + d->span) > addr))
+				d->size = 0;
+		}
+	}
+
+	/* Blocks fully inside the range no longer hold any cached code */
+	for (blk = ((uint64_t) addr + (1 << DECODE_BLOCK_SHIFT) - 1) >> DECODE_BLOCK_SHIFT; ((blk + 1) << DECODE_BLOCK_SHIFT) <= end; blk++) {
+		if (blk < dcache.map_blocks)
+			_decode_map_clear(blk << DECODE_BLOCK_SHIFT);
+	}
+
+	/* So may page entries cached by the TLB. Done last, as entries that
+	 * are still cached get tracked again.
+	 */
+	paging_tlb_write(addr, size);
+}
+
+void decode_flush(void) {
+	memset(dcache.entry, 0, sizeof(dcache.entry));
+	memset(dcache.map, 0, (dcache.map_blocks + 7) >> 3);
+}
+
+int decode_init(void) {
+	/* One extra block for instructions crossing the end of RAM */
+	dcache.map_blocks = (config.vm.ram >> DECODE_BLOCK_SHIFT) + 2;
+
+	/* Plus a spare byte, so two bits can be read at any block */
+	if (!(dcache.map = calloc(((dcache.map_blocks + 7) >> 3) + 1, 1)))
+		return -1;
+
+	decode_flush();
+
+	return 0;
+}
+
+void decode_destroy(void) {
+	free(dcache.map);
+}
+
@@ -23,9 +23,13 @@
 #include "archdefs.h"
 #include "register.h"
 #include "mm.h"
+#include "decode.h"
+#include "paging.h"
+#include "aot.h"
 #include "run.h"
 #include "sighandler.h"
 #include "io.h"
+#include "bcache.h"
 #include "config.h"
 #include "pqueue.h"
 
@@ -67,6 +71,34 @@ static void _init_mm(void) {
 	printf("%u bytes OK\n", config.vm.ram);
 }
 
+static void _init_decode(void) {
+	printf("Initializing decode cache... ");
+
+	if (decode_init() < 0) {
+		puts("Failed to allocate decode cache");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%u entries OK\n", DECODE_CACHE_SIZE);
+}
+
+static void _init_paging(void) {
+	printf("Initializing TLB... ");
+
+	if (paging_init() < 0) {
+		puts("Failed to allocate TLB");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%u entries OK\n", PAGING_TLB_SETS * PAGING_TLB_WAYS);
+}
+
+static void _init_aot(const char *path) {
+	printf("Initializing AOT cache... ");
+
+	printf("%d images OK\n", aot_init(path));
+}
+
 static void _init_bootloader(void) {
 	printf("Loading Bootloader... ");
 
@@ -75,14 +107,68 @@ static void _init_bootloader(void) {
 		exit(EXIT_FAILURE);
 	}
 
-	if (read(io.fdstor[0], (void *) (mm + MM_ZONE_NORMAL), 2048) != 2048) {
+	if (io_storage_pread(0, mm_ptr(MM_ZONE_NORMAL), 2048, 0) != 2048) {
 		puts("Failed to load bootloader.");
 		exit(EXIT_FAILURE);
 	}
 
+	/* Decode it ahead of time if cached */
+	aot_load(0, 0, 2048, MM_ZONE_NORMAL);
+
 	puts("OK");
 }
 
+static void _init_watch(void) {
+	int count;
+
+	/* Watchpoints are optional */
+	if (!config.vm.watch_count)
+		return;
+
+	printf("Arming watchpoints... ");
+
+	if ((count = mm_watch_init()) < 0) {
+		puts(MM_WATCH ? "Failed to protect watched RAM." : "Not supported by this host.");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d OK\n", count);
+}
+
+static void _init_dirty(void) {
+	int count;
+
+	/* Dirty RAM tracking is optional */
+	if (!(config.vm.mm & MM_OPT_DIRTY))
+		return;
+
+	printf("Tracking dirty RAM... ");
+
+	if ((count = mm_dirty_init()) < 0) {
+		puts(MM_DIRTY ? "Invalid granularity or RAM size." : "Not supported by this host.");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d chunks OK\n", count);
+}
+
+static void _init_bcache(void) {
+	int count;
+
+	/* Storage block cache is optional */
+	if (!config.vm.cache)
+		return;
+
+	printf("Initializing block cache... ");
+
+	if ((count = bcache_init()) < 0) {
+		puts("Invalid block size or out of memory.");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d blocks of %zu bytes OK\n", count, bcache.size);
+}
+
 static void _init_run(void) {
 	puts("Starting VM...");
 
@@ -116,10 +202,22 @@ void init_vm(const char *path) {
 
 	_init_mm();
 
+	_init_decode();
+
+	_init_paging();
+
+	_init_aot(path);
+
 	_init_io();
 
+	_init_bcache();
+
 	_init_bootloader();
 
+	_init_watch();
+
+	_init_dirty();
+
 	_init_run();
 }
 
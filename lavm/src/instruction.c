@@ -20,13 +20,12 @@
 #include <string.h>
 #include <unistd.h>
 
-#include <arpa/inet.h>
-
 #include "archdefs.h"
 #include "register.h"
 #include "instruction.h"
 #include "interrupt.h"
 #include "mm.h"
+#include "decode.h"
 #include "io.h"
 #include "fault.h"
 #include "paging.h"
@@ -35,7 +34,7 @@
 #include "config.h"
 #include "debug.h"
 #include "alu.h"
-#include "fpu.h"
+#include "run.h"
 
 
 /* Instruction table */
@@ -56,27 +55,82 @@ const struct instruction instruction[INSTRUCTION_SET_SIZE] = {
 	{ /* 0x0E */ 0, &ltsk }, /* Load Task	0 args			*/
 };
 
-static volatile void *ref_decode(leg_addr_t ref, uint8_t operand_type) {
-	return (operand_type == OPERAND_TYPE_REG) ? register_decode(ref) : (void *) (mm + ref);
+static inline volatile void *ref_decode(leg_addr_t ref, uint8_t operand_type) {
+	if (operand_type != OPERAND_TYPE_REG)
+		return (void *) (mm + ref);
+
+	/* RARTH must hold up-to-date OF/UF bits before being accessed */
+	if (ref == REG_RARTH)
+		alu_flags_sync();
+
+	return regs_list[ref / 4];
+}
+
+/* Operand values are kept in host byte order. Memory operands must have been
+ * granted already.
+ */
+static inline leg_addr_t operand_load(leg_addr_t ref, uint8_t operand_type) {
+	if (operand_type != OPERAND_TYPE_REG)
+		return mm_load_addr(ref);
+
+	return *(leg_addr_t *) ref_decode(ref, operand_type);
+}
+
+static inline void operand_store(leg_addr_t ref, uint8_t operand_type, leg_addr_t val) {
+	if (operand_type != OPERAND_TYPE_REG) {
+		mm_store_addr(ref, val);
+		return;
+	}
+
+	*(leg_addr_t *) ref_decode(ref, operand_type) = val;
 }
 
-static int operand_isreg(uint8_t operand_type) {
+static inline int operand_isreg(uint8_t operand_type) {
 	return (operand_type == OPERAND_TYPE_REG);
 }
 
-static int operand_islit(uint8_t operand_type) {
+static inline int operand_islit(uint8_t operand_type) {
 	return (operand_type == OPERAND_TYPE_LIT);
 }
 
-void cpvr(	leg_addr_t reg,
+/* Handlers built for a constant execution mode skip the RST lookups */
+static inline int instruction_paging(int mode) {
+	if (mode == INSTRUCTION_MODE_DYNAMIC)
+		return regs.rst & REG_RST_BIT_PAGING;
+
+	return mode & INSTRUCTION_MODE_PAGING;
+}
+
+static inline int instruction_priv_read(int mode, leg_addr_t reg) {
+	if (mode == INSTRUCTION_MODE_DYNAMIC)
+		return privilege_reg_req_read(privilege_get_current(), reg);
+
+	return privilege_reg_req_read(!!(mode & INSTRUCTION_MODE_LOWPRIV), reg);
+}
+
+static inline int instruction_priv_write(int mode, leg_addr_t reg) {
+	if (mode == INSTRUCTION_MODE_DYNAMIC)
+		return privilege_reg_req_write(privilege_get_current(), reg);
+
+	/* Privilege level 0 may write to any register */
+	if (!(mode & INSTRUCTION_MODE_LOWPRIV))
+		return 1;
+
+	return privilege_reg_req_write(1, reg);
+}
+
+static inline void _cpvr(	const char *name,
+		leg_addr_t reg,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 #ifdef DEBUG
 	leg_addr_t dso = reg, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -84,11 +138,11 @@ void cpvr(	leg_addr_t reg,
 	/* Grant that source operand is a register */
 	if (operand_isreg(sond_type)) {
 		/* Grant that source operand is a _valid_ register */
-		if (!register_grant_any(reg))
+		if (!checked && !register_grant_any(reg))
 			return; // Restart instruction
 
 		/* Evaluate privilege level for read access on source operand */
-		if (!privilege_reg_req_read(privilege_get_current(), reg))
+		if (!instruction_priv_read(mode, reg))
 			return;	// Restart instruction
 	} else {
 		fault_illegal_instruction();
@@ -98,53 +152,52 @@ void cpvr(	leg_addr_t reg,
 	/* If target operand is a register ... */
 	if (operand_isreg(tond_type)) {
 		/* Grant that target operand is a _valid_ register */
-		if (!register_grant_any(to))
+		if (!checked && !register_grant_any(to))
 			return; // Restart instruction
 
 		/* Verify the privilege level for register access */
-		if (!privilege_reg_req_write(privilege_get_current(), to))
+		if (!instruction_priv_write(mode, to))
 			return; // Restart instruction
 	} else {
 		/* If target operand is a memory reference ... */
 
-		/* Check if paging is enabled ... */
-		if (regs.rst & REG_RST_BIT_PAGING) {
-			/* And translate Logical to Physical address and grant
-			 * that the page has Read/Write privileges.
-			 */
-			if (!(to = paging_get_paddr(to, PAGE_PERM_RW)))
-				return; // Restart instruction
-		}
-
-		/* Sanity check - Validate zone access and boundaries */
-		if (!mm_grant_zone_normal(to))
+		/* Translate Logical to Physical address, if paging is
+		 * enabled, granting that the page has Read/Write privileges
+		 * and validating zone access and boundaries.
+		 */
+		if (!paging_grant_paddr(&to, PAGE_PERM_RW, instruction_paging(mode)))
 			return; // Restart instruction
 	}
 
-	/* Copy value from source operand to target operand with correct byte
-	 * order convertion (LEG is big endian, x86/x64 is little endian).
-	 */
-	*(leg_addr_t *) ref_decode(to, tond_type) = operand_islit(tond_type) ? htonl(*(leg_addr_t *) ref_decode(reg, sond_type)) : *(leg_addr_t *) ref_decode(reg, sond_type);
+	/* Copy value from source operand to target operand */
+	operand_store(to, tond_type, operand_load(reg, sond_type));
+
+	/* Drop any cached decode of overwritten code */
+	if (operand_islit(tond_type))
+		decode_write(to, ARCH_ADDR_BITS >> 3);
 
 	/* Update RIP to point to the next instruction */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 	
 }
 
-void cpvl(	leg_addr_t val,
+static inline void _cpvl(	const char *name,
+		leg_addr_t val,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 #ifdef DEBUG
 	leg_addr_t dso = val, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -158,52 +211,51 @@ void cpvl(	leg_addr_t val,
 	/* If target operand is a register... */
 	if (operand_isreg(tond_type)) {
 		/* Grant that target operand is a _valid_ register */
-		if (!register_grant_any(to))
+		if (!checked && !register_grant_any(to))
 			return; // Restart instruction
 
 		/* Verify the privilege level for register access */
-		if (!privilege_reg_req_write(privilege_get_current(), to))
+		if (!instruction_priv_write(mode, to))
 			return;	// Restart instruction
 	} else {
 		/* If target operand is a memory reference ... */
 
-		/* Check if paging is enabled ... */
-		if (regs.rst & REG_RST_BIT_PAGING) {
-			/* And translate Logical to Physical address and grant
-			 * that the page has Read/Write privileges.
-			 */
-			if (!(to = paging_get_paddr(to, PAGE_PERM_RW)))
-				return; // Restart instruction
-		}
-
-		/* Sanity check - Validate zone access and boundaries */
-		if (!mm_grant_zone_normal(to))
+		/* Translate Logical to Physical address, if paging is
+		 * enabled, granting that the page has Read/Write privileges
+		 * and validating zone access and boundaries.
+		 */
+		if (!paging_grant_paddr(&to, PAGE_PERM_RW, instruction_paging(mode)))
 			return; // Restart instruction
 	}
 
-	/* Copy value from source operand to target operand with correct byte
-	 * order convertion (LEG is big endian, x86/x64 is little endian).
-	 */
-	*(leg_addr_t *) ref_decode(to, tond_type) = operand_islit(tond_type) ? htonl(val) : val;
+	/* Copy value from source operand to target operand */
+	operand_store(to, tond_type, val);
+
+	/* Drop any cached decode of overwritten code */
+	if (operand_islit(tond_type))
+		decode_write(to, ARCH_ADDR_BITS >> 3);
 
 	/* Update RIP to point to the next instruction */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
 
-void cpr(	leg_addr_t from,
+static inline void _cpr(	const char *name,
+		leg_addr_t from,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 #ifdef DEBUG
 	leg_addr_t dso = from, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -211,102 +263,92 @@ void cpr(	leg_addr_t from,
 	/* If source operand is a register... */
 	if (operand_isreg(sond_type)) {
 		/* Grant that source operand is a register */
-		if (!register_grant_any(from))
+		if (!checked && !register_grant_any(from))
 			return; // Restart instruction
 
 		/* Verify the privilege level for register access */
-		if (!privilege_reg_req_read(privilege_get_current(), from))
+		if (!instruction_priv_read(mode, from))
 			return;	// Restart instruction
 	} else {
 		/* If source operand is a memory reference ... */
 
-		/* Check if paging is enabled ... */
-		if (regs.rst & REG_RST_BIT_PAGING) {
-			/* And translate Logical to Physical address and grant
-			 * that the page has Read/Write privileges.
-			 */
-			if (!(from = paging_get_paddr(from,
-					PAGE_PERM_RO | PAGE_PERM_RW)))
-				return; // Restart instruction
-		}
-
-		/* Sanity check - Validate zone access and boundaries */
-		if (!mm_grant_zone_normal(from))
+		/* Translate Logical to Physical address, if paging is
+		 * enabled, granting that the page has Read privileges and
+		 * validating zone access and boundaries.
+		 */
+		if (!paging_grant_paddr(&from, PAGE_PERM_RO | PAGE_PERM_RW, instruction_paging(mode)))
 			return; // Restart instruction
 	}
 
 	/* If target operand is a register... */
 	if (operand_isreg(tond_type)) {
 		/* Grant that target operand is a register */
-		if (!register_grant_any(to))
+		if (!checked && !register_grant_any(to))
 			return; // Restart instruction
 
 		/* Verify the privilege level for register access */
-		if (!privilege_reg_req_read(privilege_get_current(), to))
+		if (!instruction_priv_read(mode, to))
 			return;	// Restart instruction
 	} else {
 		/* If target operand is a memory reference ... */
 
-		/* Check if paging is enabled ... */
-		if (regs.rst & REG_RST_BIT_PAGING) {
-			/* And translate Logical to Physical address and grant
-			 * that the page has Read/Write privileges.
-			 */
-			if (!(to = paging_get_paddr(to, PAGE_PERM_RW)))
-				return; // Restart instruction
-		}
-
-		/* Sanity check - Validate zone access and boundaries */
-		if (!mm_grant_zone_normal(to))
+		/* Translate Logical to Physical address, if paging is
+		 * enabled, granting that the page has Read/Write privileges
+		 * and validating zone access and boundaries.
+		 */
+		if (!paging_grant_paddr(&to, PAGE_PERM_RW, instruction_paging(mode)))
 			return; // Restart instruction
 	}
 
 	if (operand_islit(tond_type) && operand_isreg(sond_type)) {
 		/* Sanity check */
-		if (!mm_grant_zone_normal(*(leg_addr_t *) ref_decode(from, sond_type)))
+		if (!mm_grant_zone_normal(operand_load(from, sond_type)))
 			return;
 
-		/* Copy memory (register value is an address) to memory,
-		 * no byte reorder needed.
-		 */
-		*(leg_addr_t *) ref_decode(to, tond_type) = *(leg_addr_t *) (mm + *(leg_addr_t *) ref_decode(from, sond_type));
+		/* Copy memory (register value is an address) to memory */
+		operand_store(to, tond_type, mm_load_addr(operand_load(from, sond_type)));
 	} else if (operand_isreg(tond_type) && operand_islit(sond_type)) {
-		/* Copy memory to register, big to little endian */
-		*(leg_addr_t *) ref_decode(to, tond_type) = ntohl(*(leg_addr_t *) ref_decode(from, sond_type));
+		/* Copy memory to register */
+		operand_store(to, tond_type, operand_load(from, sond_type));
 	} else if (operand_isreg(tond_type) && operand_isreg(sond_type)) {
 		/* Sanity check */
-		if (!mm_grant_zone_normal(*(leg_addr_t *) ref_decode(from, sond_type)))
+		if (!mm_grant_zone_normal(operand_load(from, sond_type)))
 			return;
 
-		/* Copy memory (register value is an address) to register,
-		 * big to little endian
-		 */
-		*(leg_addr_t *) ref_decode(to, tond_type) = ntohl(*(leg_addr_t *) (mm + *(leg_addr_t *) ref_decode(from, sond_type)));
+		/* Copy memory (register value is an address) to register */
+		operand_store(to, tond_type, mm_load_addr(operand_load(from, sond_type)));
 	} else {
-		/* Copy memory to memory, no byte reordering */
-		*(leg_addr_t *) ref_decode(to, tond_type) = *(leg_addr_t *) ref_decode(from, sond_type);
+		/* Copy memory to memory */
+		operand_store(to, tond_type, operand_load(from, sond_type));
 	}
 
+	/* Drop any cached decode of overwritten code */
+	if (operand_islit(tond_type))
+		decode_write(to, ARCH_ADDR_BITS >> 3);
+
 	/* Update RIP to point to the next instruction */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
 
-void cprr(	leg_addr_t from,
+static inline void _cprr(	const char *name,
+		leg_addr_t from,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 	leg_addr_t to_ref;
 
 #ifdef DEBUG
 	leg_addr_t dso = from, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -324,62 +366,62 @@ void cprr(	leg_addr_t from,
 	}
 
 	/* Grant that source operand is a _valid_ register */
-	if (!register_grant_any(from))
+	if (!checked && !register_grant_any(from))
 		return; // Restart instruction
 
 	/* Grant that target operand is a _valid_ register */
-	if (!register_grant_any(to))
+	if (!checked && !register_grant_any(to))
 		return; // Restart instruction
 
 	/* Grant that there's read permission on source operand */
-	if (!privilege_reg_req_write(privilege_get_current(), to))
+	if (!instruction_priv_write(mode, to))
 		return; // Restart instruction
 
 	/* Grant that there's write permission on target operand */
-	if (!privilege_reg_req_read(privilege_get_current(), from))
+	if (!instruction_priv_read(mode, from))
 		return; // Restart instruction
 
 	/* Extract memory reference from target operand */
-	to_ref = (*(leg_addr_t *) ref_decode(to, tond_type));
-
-	/* If paging is enabled ... */
-	if (regs.rst & REG_RST_BIT_PAGING) {
-		/* Translate Logical to Physical address and grant that
-		 * there Read/Write privileges on that page
-		 */
-		if (!(to_ref = paging_get_paddr(to_ref, PAGE_PERM_RW)))
-			return; // Restart instruction
-	}
+	to_ref = operand_load(to, tond_type);
 
-	/* Grant zone normal */
-	if (!mm_grant_zone_normal(to_ref))
+	/* Translate Logical to Physical address, if paging is enabled, and
+	 * grant that there are Read/Write privileges on that page and that
+	 * it belongs to zone normal
+	 */
+	if (!paging_grant_paddr(&to_ref, PAGE_PERM_RW, instruction_paging(mode)))
 		return; // Restart instruction
 
 	/* Copy source operand value to the memory reference pointed by the
 	 * target operand
 	 */
-	*(leg_addr_t *) (mm + to_ref) = htonl(*(leg_addr_t *) ref_decode(from, sond_type));
+	mm_store_addr(to_ref, operand_load(from, sond_type));
+
+	/* Drop any cached decode of overwritten code */
+	decode_write(to_ref, ARCH_ADDR_BITS >> 3);
 
 	/* Update RIP to point to the next instruction */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
 
-void cmp(	leg_addr_t from,
+static inline void _cmp(	const char *name,
+		leg_addr_t from,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 	leg_addr_t val1, val2;
 
 #ifdef DEBUG
 	leg_addr_t dso = from, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -397,19 +439,19 @@ void cmp(	leg_addr_t from,
 	}
 
 	/* Grant that source operand is a _valid_ register */
-	if (!register_grant_any(from))
+	if (!checked && !register_grant_any(from))
 		return; // Restart instruction
 
 	/* Grant that target operand is a _valid_ register */
-	if (!register_grant_any(to))
+	if (!checked && !register_grant_any(to))
 		return; // Restart instruction
 
 	/* Grant that there's read permission on source operand */
-	if (!privilege_reg_req_write(privilege_get_current(), to))
+	if (!instruction_priv_write(mode, to))
 		return; // Restart instruction
 
 	/* Grant that there's write permission on target operand */
-	if (!privilege_reg_req_read(privilege_get_current(), from))
+	if (!instruction_priv_read(mode, from))
 		return; // Restart instruction
 
 	/* Clear result bit from RCMP */
@@ -457,7 +499,7 @@ void cmp(	leg_addr_t from,
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
@@ -490,17 +532,20 @@ void jmp(	leg_addr_t addr,
 #endif
 }
 
-void call(	leg_addr_t addr,
+static inline void _call(	const char *name,
+		leg_addr_t addr,
 		leg_addr_t reserved,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 	leg_addr_t prra = regs.rra; // Assume RRA points to a Physical Address
 
 #ifdef DEBUG
 	leg_addr_t dso = addr;
 
-	if (!debug_instruction_enter(__func__, dso, 0, opcode_size,
+	if (!debug_instruction_enter(name, dso, 0, opcode_size,
 			sond_type, OPERAND_TYPE_NONE))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -508,19 +553,17 @@ void call(	leg_addr_t addr,
 	/* Increment temporary RRA address */
 	prra += (ARCH_ADDR_BITS >> 3);
 
-	/* If paging is enabled ... */
-	if (regs.rst & REG_RST_BIT_PAGING) {
-		/* Translate Logical Address to Physical Address */
-		if (!(prra = paging_get_paddr(prra, PAGE_PERM_RO)))
-			return; // Restart instruction
-	}
-
-	/* Check if temporary Physical RRA Address belongs to normal zone */
-	if (!mm_grant_zone_normal(prra))
+	/* Translate Logical Address to Physical Address, if paging is enabled,
+	 * and check if it belongs to normal zone
+	 */
+	if (!paging_grant_paddr(&prra, PAGE_PERM_RO, instruction_paging(mode)))
 		return; // Restart instruction
 
 	/* Push return address into RRA */
-	*(leg_addr_t *) (mm + prra) = htonl(regs.rip + opcode_size);
+	mm_store_addr(prra, regs.rip + opcode_size);
+
+	/* Drop any cached decode of overwritten code */
+	decode_write(prra, ARCH_ADDR_BITS >> 3);
 
 	/* Update RRA value */
 	regs.rra += (ARCH_ADDR_BITS >> 3);
@@ -529,69 +572,57 @@ void call(	leg_addr_t addr,
 	regs.rip = addr;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, 0, opcode_size,
+	debug_instruction_leave(name, dso, 0, opcode_size,
 		sond_type, OPERAND_TYPE_NONE);
 #endif
 }
 
-void ret(	leg_addr_t reserved1,
+static inline void _ret(	const char *name,
+		leg_addr_t reserved1,
 		leg_addr_t reserved2,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 	leg_addr_t prra = regs.rra; // Assume RRA points to a Physical Address
 
 #ifdef DEBUG
-	if (!debug_instruction_enter(__func__, 0, 0, opcode_size,
+	if (!debug_instruction_enter(name, 0, 0, opcode_size,
 			OPERAND_TYPE_NONE, OPERAND_TYPE_NONE))
 		return; // Incomplete. Restart instruction.
 #endif
 
-	/* If paging is enabled ... */
-	if (regs.rst & REG_RST_BIT_PAGING) {
-		/* Translate Logical Address to Physical Address */
-		if (!(prra = paging_get_paddr(prra, PAGE_PERM_RO)))
-			return; // Restart instruction
-	}
-
-	/* Check if temporary Physical RRA Address belongs to normal zone */
-	if (!mm_grant_zone_normal(prra))
+	/* Translate Logical Address to Physical Address, if paging is enabled,
+	 * and check if it belongs to normal zone
+	 */
+	if (!paging_grant_paddr(&prra, PAGE_PERM_RO, instruction_paging(mode)))
 		return;
 
 	/* Pop return address */
-	regs.rip = ntohl(*(leg_addr_t *) (mm + prra));
+	regs.rip = mm_load_addr(prra);
 
 	/* Update RRA value */
 	regs.rra -= (ARCH_ADDR_BITS >> 3);
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, 0, 0, opcode_size,
+	debug_instruction_leave(name, 0, 0, opcode_size,
 		OPERAND_TYPE_NONE, OPERAND_TYPE_NONE);
 #endif
 }
 
-void arth(	leg_addr_t from,
+static inline void _arth(	const char *name,
+		leg_addr_t from,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
-	leg_char_t char_val1 = 0, char_val2 = 0;
-	leg_uchar_t uchar_val1 = 0, uchar_val2 = 0;
-	leg_short_t short_val1 = 0, short_val2 = 0;
-	leg_ushort_t ushort_val1 = 0, ushort_val2 = 0;
-	leg_int_t int_val1 = 0, int_val2 = 0;
-	leg_uint_t uint_val1 = 0, uint_val2 = 0;
-	leg_ulong_t ulong_val1 = 0, ulong_val2 = 0;
-	leg_long_t long_val1 = 0, long_val2 = 0;
-	leg_float_t float_val1 = 0, float_val2 = 0;
-	leg_double_t double_val = 0;
-	uint8_t type = 0;
-
-	/* TODO: break this huge function into smaller routines */
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 #ifdef DEBUG
 	leg_addr_t dso = from, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -609,341 +640,47 @@ void arth(	leg_addr_t from,
 	}
 
 	/* Grant that source operand is a _valid_ register */
-	if (!register_grant_any(from))
+	if (!checked && !register_grant_any(from))
 		return; // Restart instruction
 
 	/* Grant that target operand is a _valid_ register */
-	if (!register_grant_any(to))
+	if (!checked && !register_grant_any(to))
 		return; // Restart instruction
 
 	/* Grant that there's read permission on source operand */
-	if (!privilege_reg_req_write(privilege_get_current(), to))
+	if (!instruction_priv_write(mode, to))
 		return; // Restart instruction
 
 	/* Grant that there's write permission on target operand */
-	if (!privilege_reg_req_read(privilege_get_current(), from))
+	if (!instruction_priv_read(mode, from))
 		return; // Restart instruction
 
-	/* Get values from registers into temporary variables */
-	if (register_is_rfp(from) || register_is_rfp(to)) {
-		memcpy(&float_val1, (void *) ref_decode(from, sond_type), 4);
-		memcpy(&float_val2, (void *) ref_decode(to, tond_type), 4);
-
-		/* Extended operand indicates double precision */
-		type = 1 + !!(regs.rarth & (REG_ARTH_BIT_ERFP1 | REG_ARTH_BIT_ERFP2 | REG_ARTH_BIT_ERFP3 | REG_ARTH_BIT_ERFP4));
-	} else {
-		if (regs.rarth & REG_ARTH_BIT_SIGNED) {
-			if (regs.rarth & REG_ARTH_BIT_8BITOP) {
-				char_val1 = *(leg_char_t *) ref_decode(from, sond_type);
-				char_val2 = *(leg_char_t *) ref_decode(to, tond_type);
-				type = 5;
-			} else if (regs.rarth & REG_ARTH_BIT_16BITOP) {
-				short_val1 = *(leg_short_t *) ref_decode(from, sond_type);
-				short_val2 = *(leg_short_t *) ref_decode(to, tond_type);
-				type = 6;
-			} else if (regs.rarth & REG_ARTH_BIT_32BITOP) {
-#if ARCH_ADDR_BITS == 64
-				int_val1 = *(leg_int_t *) ref_decode(from, sond_type);
-				int_val2 = *(leg_int_t *) ref_decode(to, tond_type);
-				type = 7;
-#else
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-#endif
-			} else {
-				long_val1 = *(leg_long_t *) ref_decode(from, sond_type);
-				long_val2 = *(leg_long_t *) ref_decode(to, tond_type);
-				type = 3;
-			}
-		} else {
-			if (regs.rarth & REG_ARTH_BIT_8BITOP) {
-				uchar_val1 = *(leg_uchar_t *) ref_decode(from, sond_type);
-				uchar_val2 = *(leg_uchar_t *) ref_decode(to, tond_type);
-				type = 8;
-			} else if (regs.rarth & REG_ARTH_BIT_16BITOP) {
-				ushort_val1 = *(leg_ushort_t *) ref_decode(from, sond_type);
-				ushort_val2 = *(leg_ushort_t *) ref_decode(to, tond_type);
-				type = 9;
-			} else if (regs.rarth & REG_ARTH_BIT_32BITOP) {
-#if ARCH_ADDR_BITS == 64
-				uint_val1 = *(leg_uint_t *) ref_decode(from, sond_type);
-				uint_val2 = *(leg_uint_t *) ref_decode(to, tond_type);
-				type = 10;
-#else
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-#endif
-			} else {
-				ulong_val1 = *(leg_ulong_t *) ref_decode(from, sond_type);
-				ulong_val2 = *(leg_ulong_t *) ref_decode(to, tond_type);
-				type = 4;
-			}
-		}
-	}
-
-	/* Remove OF and UF bits if they're set */
-	regs.rarth &= ~REG_ARTH_BIT_OF;
-	regs.rarth &= ~REG_ARTH_BIT_UF;
-
-	/* Perform arithmetic operation */
-	switch (regs.rarth &
-			(REG_ARTH_BIT_MUL | REG_ARTH_BIT_DIV |
-			REG_ARTH_BIT_SUB | REG_ARTH_BIT_ADD |
-			REG_ARTH_BIT_MOD)) {
-
-		case REG_ARTH_BIT_MUL:
-			switch (type) {
-				case 1: float_val2 = fpu_mul_float(float_val1, float_val2); break;
-				case 2: double_val = fpu_mul_double(float_val1, float_val2); break;
-				case 3: long_val2 = alu_mul_long(long_val1, long_val2); break;
-				case 4: ulong_val2 = alu_mul_ulong(ulong_val1, ulong_val2);
-				case 5: char_val2 = alu_mul_char(char_val1, char_val2); break;
-				case 6: short_val2 = alu_mul_short(short_val1, short_val2); break;
-				case 7: int_val2 = alu_mul_int(int_val1, int_val2); break;
-				case 8: uchar_val2 = alu_mul_uchar(uchar_val1, uchar_val2); break;
-				case 9: ushort_val2 = alu_mul_ushort(ushort_val1, ushort_val2); break;
-				case 10: uint_val2 = alu_mul_uint(uint_val1, uint_val2); break;
-				default: fault_bad_reg_val(REG_RARTH, regs.rarth); return;
-			}
-
-			break;
-		case REG_ARTH_BIT_DIV:
-			if (type == 1) {
-				if (!float_val1) {
-					fault_fpu();
-					return;
-				}
-
-				float_val2 = fpu_div_float(float_val1, float_val2);
-			} else if (type == 2) {
-				if (!float_val1) {
-					fault_fpu();
-					return;
-				}
-
-				double_val = fpu_div_double(float_val1, float_val2);
-			} else if (type == 3) {
-				if (!long_val1) {
-					fault_alu();
-					return;
-				}
-
-				long_val2 = alu_div_long(long_val1, long_val2);
-			} else if (type == 4) {
-				if (!ulong_val1) {
-					fault_alu();
-					return;
-				}
-
-				ulong_val2 = alu_div_ulong(ulong_val1, ulong_val2);
-			} else if (type == 5) {
-				if (!char_val1) {
-					fault_alu();
-					return;
-				}
-
-				char_val2 = alu_div_char(char_val1, char_val2);
-			} else if (type == 6) {
-				if (!short_val1) {
-					fault_alu();
-					return;
-				}
-
-				short_val2 = alu_div_short(short_val1, short_val2);
-			} else if (type == 7) {
-				if (!int_val1) {
-					fault_alu();
-					return;
-				}
-
-				int_val2 = alu_div_int(int_val1, int_val2);
-			} else if (type == 8) {
-				if (!uchar_val1) {
-					fault_alu();
-					return;
-				}
-
-				uchar_val2 = alu_div_uchar(uchar_val1, uchar_val2);
-			} else if (type == 9) {
-				if (!ushort_val1) {
-					fault_alu();
-					return;
-				}
-
-				ushort_val2 = alu_div_ushort(ushort_val1, ushort_val2);
-			} else if (type == 10) {
-				if (!uint_val1) {
-					fault_alu();
-					return;
-				}
-
-				uint_val2 = alu_div_uint(uint_val1, uint_val2);
-			} else {
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-			}
-
-			break;
-		case REG_ARTH_BIT_SUB:
-			switch (type) {
-				case 1: float_val2 = fpu_sub_float(float_val1, float_val2); break;
-				case 2: double_val = fpu_sub_double(float_val1, float_val2); break;
-				case 3: long_val2 = alu_sub_long(long_val1, long_val2); break;
-				case 4: ulong_val2 = alu_sub_ulong(ulong_val1, ulong_val2);
-				case 5: char_val2 = alu_sub_char(char_val1, char_val2); break;
-				case 6: short_val2 = alu_sub_short(short_val1, short_val2); break;
-				case 7: int_val2 = alu_sub_int(int_val1, int_val2); break;
-				case 8: uchar_val2 = alu_sub_uchar(uchar_val1, uchar_val2); break;
-				case 9: ushort_val2 = alu_sub_ushort(ushort_val1, ushort_val2); break;
-				case 10: uint_val2 = alu_sub_uint(uint_val1, uint_val2); break;
-				default: fault_bad_reg_val(REG_RARTH, regs.rarth); return;
-			}
-			break;
-		case REG_ARTH_BIT_ADD:
-			switch (type) {
-				case 1: float_val2 = fpu_add_float(float_val1, float_val2); break;
-				case 2: double_val = fpu_add_double(float_val1, float_val2); break;
-				case 3: long_val2 = alu_add_long(long_val1, long_val2); break;
-				case 4: ulong_val2 = alu_add_ulong(ulong_val1, ulong_val2);
-				case 5: char_val2 = alu_add_char(char_val1, char_val2); break;
-				case 6: short_val2 = alu_add_short(short_val1, short_val2); break;
-				case 7: int_val2 = alu_add_int(int_val1, int_val2); break;
-				case 8: uchar_val2 = alu_add_uchar(uchar_val1, uchar_val2); break;
-				case 9: ushort_val2 = alu_add_ushort(ushort_val1, ushort_val2); break;
-				case 10: uint_val2 = alu_add_uint(uint_val1, uint_val2); break;
-				default: fault_bad_reg_val(REG_RARTH, regs.rarth); return;
-			}
-			break;
-		case REG_ARTH_BIT_MOD:
-			if (type == 1) {
-				/* No mod op permitted on RFP regs */
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-			} else if (type == 2) {
-				/* No mod op permitted on RFP regs */
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-			} else if (type == 3) {
-				if (!long_val1) {
-					fault_alu();
-					return;
-				}
-
-				long_val2 = alu_mod_long(long_val1, long_val2);
-			} else if (type == 4) {
-				if (!ulong_val1) {
-					fault_alu();
-					return;
-				}
-
-				ulong_val2 = alu_mod_ulong(ulong_val1, ulong_val2);
-			} else if (type == 5) {
-				if (!char_val1) {
-					fault_alu();
-					return;
-				}
-
-				char_val2 = alu_mod_char(char_val1, char_val2);
-			} else if (type == 6) {
-				if (!short_val1) {
-					fault_alu();
-					return;
-				}
-
-				short_val2 = alu_mod_short(short_val1, short_val2);
-			} else if (type == 7) {
-				if (!int_val1) {
-					fault_alu();
-					return;
-				}
-
-				int_val2 = alu_mod_int(int_val1, int_val2);
-			} else if (type == 8) {
-				if (!uchar_val1) {
-					fault_alu();
-					return;
-				}
-
-				uchar_val2 = alu_mod_uchar(uchar_val1, uchar_val2);
-			} else if (type == 9) {
-				if (!ushort_val1) {
-					fault_alu();
-					return;
-				}
-
-				ushort_val2 = alu_mod_ushort(ushort_val1, ushort_val2);
-			} else if (type == 10) {
-				if (!uint_val1) {
-					fault_alu();
-					return;
-				}
-
-				uint_val2 = alu_mod_uint(uint_val1, uint_val2);
-			} else {
-				fault_bad_reg_val(REG_RARTH, regs.rarth);
-				return;
-			}
-
-			break;
-		default: fault_bad_reg_val(REG_RARTH, regs.rarth);
-			 return; // Restart instruction
-	}
-
-	/* Update target operand with the result */
-	if (type == 1) {
-		memcpy((void *) ref_decode(to, tond_type), &float_val2, 4);
-	} else if (type == 2) {
-		memcpy((void *) ref_decode(to, tond_type), &double_val, 4);
-		/* Most significant part is stored at the selected extended
-		 * operand register
-		 */
-	} else if (type == 3) {
-		*(leg_long_t *) ref_decode(to, tond_type) = long_val2;
-	} else if (type == 4) {
-		*(leg_ulong_t *) ref_decode(to, tond_type) = ulong_val2;
-	} else if (type == 5) {
-		*(leg_char_t *) ref_decode(to, tond_type) = char_val2;
-	} else if (type == 6) {
-		*(leg_short_t *) ref_decode(to, tond_type) = short_val2;
-	} else if (type == 7) {
-		*(leg_int_t *) ref_decode(to, tond_type) = int_val2;
-	} else if (type == 8) {
-		*(leg_uchar_t *) ref_decode(to, tond_type) = uchar_val2;
-	} else if (type == 9) {
-		*(leg_ushort_t *) ref_decode(to, tond_type) = ushort_val2;
-	} else if (type == 10) {
-		*(leg_uint_t *) ref_decode(to, tond_type) = uint_val2;
-	} else {
-		fault_bad_reg_val(REG_RARTH, regs.rarth);
-		return;
-	}
+	/* Run the kernel resolved for the current RARTH value */
+	if (alu_arth(ref_decode(from, sond_type), ref_decode(to, tond_type),
+			register_is_rfp(from) || register_is_rfp(to)) < 0)
+		return; // Restart instruction
 
 	/* Update RIP */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
 
-void lgic(	leg_addr_t from,
+static inline void _lgic(	const char *name,
+		leg_addr_t from,
 		leg_addr_t to,
 		uint8_t opcode_size,
 		uint8_t sond_type,
-		uint8_t tond_type) {
-	leg_uchar_t uchar_val1 = 0, uchar_val2 = 0;
-	leg_ushort_t ushort_val1 = 0, ushort_val2 = 0;
-	leg_uint_t uint_val1 = 0, uint_val2 = 0;
-	leg_ulong_t ulong_val1 = 0, ulong_val2 = 0;
-	leg_addr_t trlgic = regs.rlgic;
-	uint8_t neg_res = 0, type = 0;
-
-	/* TODO: break this huge function into smaller routines */
+		uint8_t tond_type,
+		int checked,
+		int mode) {
 #ifdef DEBUG
 	leg_addr_t dso = from, dto = to;
 
-	if (!debug_instruction_enter(__func__, dso, dto, opcode_size,
+	if (!debug_instruction_enter(name, dso, dto, opcode_size,
 			sond_type, tond_type))
 		return; // Incomplete. Restart instruction.
 #endif
@@ -961,11 +698,11 @@ void lgic(	leg_addr_t from,
 	}
 
 	/* Grant that source operand is a _valid_ register */
-	if (!register_grant_any(from))
+	if (!checked && !register_grant_any(from))
 		return; // Restart instruction
 
 	/* Grant that target operand is a _valid_ register */
-	if (!register_grant_any(to))
+	if (!checked && !register_grant_any(to))
 		return; // Restart instruction
 
 	/* No lgic instructions of RFP registers */
@@ -975,159 +712,22 @@ void lgic(	leg_addr_t from,
 	}
 
 	/* Grant that there's read permission on source operand */
-	if (!privilege_reg_req_write(privilege_get_current(), to))
+	if (!instruction_priv_write(mode, to))
 		return; // Restart instruction
 
 	/* Grant that there's write permission on target operand */
-	if (!privilege_reg_req_read(privilege_get_current(), from))
+	if (!instruction_priv_read(mode, from))
 		return; // Restart instruction
 
-	if (regs.rlgic & REG_RLGIC_BIT_8BITOP) {
-		uchar_val1 = *(leg_uchar_t *) ref_decode(from, sond_type);
-		uchar_val2 = *(leg_uchar_t *) ref_decode(to, tond_type);
-		type = 1;
-	} else if (regs.rlgic & REG_RLGIC_BIT_16BITOP) {
-		ushort_val1 = *(leg_ushort_t *) ref_decode(from, sond_type);
-		ushort_val2 = *(leg_ushort_t *) ref_decode(to, tond_type);
-		type = 2;
-	} else if (regs.rlgic & REG_RLGIC_BIT_32BITOP) {
-#if ARCH_ADDR_BITS == 64
-		uint_val1 = *(leg_uint_t *) ref_decode(from, sond_type);
-		uint_val2 = *(leg_uint_t *) ref_decode(to, tond_type);
-		type = 3;
-#else
-		fault_bad_reg_val(REG_RLGIC, regs.rlgic);
-#endif
-	} else {
-		ulong_val1 = *(leg_ulong_t *) ref_decode(from, sond_type);
-		ulong_val2 = *(leg_ulong_t *) ref_decode(to, tond_type);
-		type = 4;
-	}
-
-	/* Check if there are multiple (and valid) operations */
-	if ((regs.rlgic & ~REG_RLGIC_BIT_NOT) &&
-			(regs.rlgic & REG_RLGIC_BIT_NOT)) {
-		trlgic = regs.rlgic & ~REG_RLGIC_BIT_NOT;
-		neg_res = 1;
-	}
-
-	switch (trlgic &
-			(REG_RLGIC_BIT_NOT | REG_RLGIC_BIT_XOR |
-			REG_RLGIC_BIT_AND | REG_RLGIC_BIT_OR |
-			REG_RLGIC_BIT_SHL | REG_RLGIC_BIT_SHR |
-			REG_RLGIC_BIT_ROL)) {
-
-		case REG_RLGIC_BIT_NOT: 
-			switch (type) {
-				case 1: uchar_val2 = alu_not_uchar(uchar_val1); break;
-				case 2: ushort_val2 = alu_not_ushort(ushort_val1); break;
-				case 3: uint_val2 = alu_not_uint(uint_val1); break;
-				case 4: ulong_val2 = alu_not_ulong(ulong_val1); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_XOR:
-			switch (type) {
-				case 1: uchar_val2 = alu_xor_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_xor_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_xor_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_xor_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_AND:
-			switch (type) {
-				case 1: uchar_val2 = alu_and_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_and_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_and_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_and_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_OR:
-			switch (type) {
-				case 1: uchar_val2 = alu_or_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_or_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_or_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_or_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_SHL:
-			switch (type) {
-				case 1: uchar_val2 = alu_shl_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_shl_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_shl_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_shl_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_SHR:
-			switch (type) {
-				case 1: uchar_val2 = alu_shr_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_shr_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_shr_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_shr_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_ROL:
-			switch (type) {
-				case 1: uchar_val2 = alu_rol_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_rol_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_rol_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_rol_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		case REG_RLGIC_BIT_ROR:
-			switch (type) {
-				case 1: uchar_val2 = alu_ror_uchar(uchar_val1, uchar_val2); break;
-				case 2: ushort_val2 = alu_ror_ushort(ushort_val1, ushort_val2); break;
-				case 3: uint_val2 = alu_ror_uint(uint_val1, uint_val2); break;
-				case 4: ulong_val2 = alu_ror_ulong(ulong_val1, ulong_val2); break;
-				default: fault_bad_reg_val(REG_RLGIC, regs.rlgic); return;
-			}
-			break;
-		default: fault_bad_reg_val(REG_RLGIC, regs.rlgic);
-			 return; // Restart instruction
-	}
+	/* Run the kernel resolved for the current RLGIC value */
+	if (alu_lgic(ref_decode(from, sond_type), ref_decode(to, tond_type)) < 0)
+		return; // Restart instruction
 
-	/* Update target operand with the result */
-	if (type == 1) {
-		/* Perform a NOT after the logic op if necessary */
-		if (neg_res)
-			uchar_val2 = alu_not_uchar(uchar_val2);
-
-		*(leg_uchar_t *) ref_decode(to, tond_type) = uchar_val2;
-	} else if (type == 2) {
-		/* Perform a NOT after the logic op if necessary */
-		if (neg_res)
-			ushort_val2 = alu_not_ushort(ushort_val2);
-
-		*(leg_ushort_t *) ref_decode(to, tond_type) = ushort_val2;
-	} else if (type == 3) {
-		/* Perform a NOT after the logic op if necessary */
-		if (neg_res)
-			uint_val2 = alu_not_uint(uint_val2);
-
-		*(leg_uint_t *) ref_decode(to, tond_type) = uint_val2;
-	} else if (type == 4) {
-		/* Perform a NOT after the logic op if necessary */
-		if (neg_res)
-			ulong_val2 = alu_not_ulong(ulong_val2);
-
-		*(leg_ulong_t *) ref_decode(to, tond_type) = ulong_val2;
-	} else {
-		fault_bad_reg_val(REG_RLGIC, regs.rlgic);
-		return;
-	}
-		
 	/* Update RIP */
 	regs.rip += opcode_size;
 
 #ifdef DEBUG
-	debug_instruction_leave(__func__, dso, dto, opcode_size,
+	debug_instruction_leave(name, dso, dto, opcode_size,
 		sond_type, tond_type);
 #endif
 }
@@ -1156,11 +756,23 @@ void intr(	leg_addr_t intrid,
 			interrupt_int0a(regs.rgp1);
 			break;
 		case INTR_0B:
-			interrupt_int0b(regs.rgp1, regs.rgp2, regs.rgp3, regs.rgp4, regs.rgp5);
+			interrupt_int0b(regs.rgp1, regs.rgp2, regs.rgp3, regs.rgp4, regs.rgp5, regs.rgp6);
 			break;
 		case INTR_0D:
 			interrupt_int0d(regs.rgp1);
 			break;
+		case INTR_11:
+			interrupt_int11(regs.rgp1, regs.rgp2, regs.rgp3);
+			break;
+		case INTR_13:
+			interrupt_int13(regs.rgp1, regs.rgp2);
+			break;
+		case INTR_14:
+			interrupt_int14(regs.rgp1, regs.rgp2, regs.rgp3, regs.rgp4, regs.rgp5);
+			break;
+		case INTR_15:
+			interrupt_int15();
+			break;
 		default: interrupt_intvr_handler(intrid);
 	}
 
@@ -1223,7 +835,7 @@ void ltsk(	leg_addr_t reserved1,
 		uint8_t opcode_size,
 		uint8_t operand1_type,
 		uint8_t operand2_type) {
-	uint32_t prct = regs.rct; // Assume RCT value is a Physical Address
+	leg_addr_t prct = regs.rct; // Assume RCT value is a Physical Address
 
 #ifdef DEBUG
 	if (!debug_instruction_enter(__func__, 0, 0, opcode_size,
@@ -1231,15 +843,10 @@ void ltsk(	leg_addr_t reserved1,
 		return; // Incomplete. Restart instruction.
 #endif
 
-	/* If paging is enabled ... */
-	if (regs.rst & REG_RST_BIT_PAGING) {
-		/* Translate Logical Address to Physical Address */
-		if (!(prct = paging_get_paddr(prct, PAGE_PERM_RW)))
-			return; // Restart instruction
-	}
-
-	/* Check if temporary Physical RST Address belongs to normal zone */
-	if (!mm_grant_zone_normal(prct))
+	/* Translate Logical Address to Physical Address, if paging is enabled,
+	 * and check if it belongs to normal zone
+	 */
+	if (!paging_grant_paddr(&prct, PAGE_PERM_RW, regs.rst & REG_RST_BIT_PAGING))
 		return;
 
 	if (regs.rst & REG_RST_BIT_TSK) {
@@ -1256,3 +863,525 @@ void ltsk(	leg_addr_t reserved1,
 #endif
 }
 
+/* Reference handlers. Operand kinds, register IDs and the execution mode
+ * are evaluated on every execution.
+ */
+#define INSTRUCTION_GENERIC(op) \
+void op(leg_addr_t oper1, leg_addr_t oper2, uint8_t opcode_size, uint8_t sond_type, uint8_t tond_type) { \
+	_##op(#op, oper1, oper2, opcode_size, sond_type, tond_type, 0, INSTRUCTION_MODE_DYNAMIC); \
+}
+
+INSTRUCTION_GENERIC(cpvr)
+INSTRUCTION_GENERIC(cpvl)
+INSTRUCTION_GENERIC(cpr)
+INSTRUCTION_GENERIC(cprr)
+INSTRUCTION_GENERIC(cmp)
+INSTRUCTION_GENERIC(call)
+INSTRUCTION_GENERIC(ret)
+INSTRUCTION_GENERIC(arth)
+INSTRUCTION_GENERIC(lgic)
+
+/* Specialized handlers. Operand kinds and execution mode are constant and
+ * register IDs were validated by instruction_specialize(). One handler is
+ * built for each mode: privilege level 0/1, paging off/on.
+ */
+#define INSTRUCTION_VARIANT_MODE(op, sfx, t1, t2, msfx, mode) \
+static void op##_##sfx##_##msfx(leg_addr_t oper1, leg_addr_t oper2, uint8_t opcode_size, uint8_t sond_type, uint8_t tond_type) { \
+	_##op(#op, oper1, oper2, opcode_size, OPERAND_TYPE_##t1, OPERAND_TYPE_##t2, 1, mode); \
+}
+
+#define INSTRUCTION_VARIANT(id, op, sfx, t1, t2) \
+	INSTRUCTION_VARIANT_MODE(op, sfx, t1, t2, pl0, 0) \
+	INSTRUCTION_VARIANT_MODE(op, sfx, t1, t2, pl0pg, INSTRUCTION_MODE_PAGING) \
+	INSTRUCTION_VARIANT_MODE(op, sfx, t1, t2, pl1, INSTRUCTION_MODE_LOWPRIV) \
+	INSTRUCTION_VARIANT_MODE(op, sfx, t1, t2, pl1pg, INSTRUCTION_MODE_LOWPRIV | INSTRUCTION_MODE_PAGING)
+
+INSTRUCTION_VARIANTS(INSTRUCTION_VARIANT)
+
+/* Dispatch tables, one per execution mode. The first entries hold the
+ * reference handlers, indexed by instruction ID - 1.
+ */
+#define INSTRUCTION_DISPATCH_GENERIC \
+	&cpvr, &cpvl, &cpr, &cprr, &cmp, &jmp, &call, \
+	&ret, &arth, &lgic, &intr, &ceb, &nop, &ltsk
+
+#define INSTRUCTION_DISPATCH_PL0(id, op, sfx, t1, t2) [INSTRUCTION_##op##_##sfx] = &op##_##sfx##_pl0,
+#define INSTRUCTION_DISPATCH_PL0PG(id, op, sfx, t1, t2) [INSTRUCTION_##op##_##sfx] = &op##_##sfx##_pl0pg,
+#define INSTRUCTION_DISPATCH_PL1(id, op, sfx, t1, t2) [INSTRUCTION_##op##_##sfx] = &op##_##sfx##_pl1,
+#define INSTRUCTION_DISPATCH_PL1PG(id, op, sfx, t1, t2) [INSTRUCTION_##op##_##sfx] = &op##_##sfx##_pl1pg,
+
+void (*const instruction_dispatch[INSTRUCTION_MODES][INSTRUCTION_VARIANT_MAX]) (leg_addr_t, leg_addr_t, uint8_t, uint8_t, uint8_t) = {
+	[0] = { INSTRUCTION_DISPATCH_GENERIC, INSTRUCTION_VARIANTS(INSTRUCTION_DISPATCH_PL0) },
+	[INSTRUCTION_MODE_PAGING] = { INSTRUCTION_DISPATCH_GENERIC, INSTRUCTION_VARIANTS(INSTRUCTION_DISPATCH_PL0PG) },
+	[INSTRUCTION_MODE_LOWPRIV] = { INSTRUCTION_DISPATCH_GENERIC, INSTRUCTION_VARIANTS(INSTRUCTION_DISPATCH_PL1) },
+	[INSTRUCTION_MODE_LOWPRIV | INSTRUCTION_MODE_PAGING] = { INSTRUCTION_DISPATCH_GENERIC, INSTRUCTION_VARIANTS(INSTRUCTION_DISPATCH_PL1PG) },
+};
+
+#define INSTRUCTION_VARIANT_ENTRY(id, op, sfx, t1, t2) \
+	[id - 1][OPERAND_TYPE_##t1][OPERAND_TYPE_##t2] = INSTRUCTION_##op##_##sfx,
+
+static const uint8_t instruction_variant[INSTRUCTION_SET_SIZE][3][3] = {
+	INSTRUCTION_VARIANTS(INSTRUCTION_VARIANT_ENTRY)
+};
+
+void instruction_specialize(struct decode *d) {
+	/* Use the reference handler unless a variant matches the operands */
+	d->variant = d->id - 1;
+
+	if (!instruction_variant[d->id - 1][d->oper1_type][d->oper2_type])
+		return;
+
+	/* Invalid register IDs must fault at execution time */
+	if (operand_isreg(d->oper1_type) && !register_is_valid(d->oper1))
+		return;
+
+	if (operand_isreg(d->oper2_type) && !register_is_valid(d->oper2))
+		return;
+
+	d->variant = instruction_variant[d->id - 1][d->oper1_type][d->oper2_type];
+}
+
+/* Superinstructions. The fused instructions run through the same handlers
+ * and the group is left as soon as the run loop would have done something
+ * else between them.
+ */
+#define INSTRUCTION_FUSIONS(X) \
+	X(INSTRUCTION_FUSE_CPVL_CMP, cpvl_cmp) \
+	X(INSTRUCTION_FUSE_CPVL_CMP_JMP, cpvl_cmp_jmp) \
+	X(INSTRUCTION_FUSE_CPVL_ARTH, cpvl_arth) \
+	X(INSTRUCTION_FUSE_CPVL_LGIC, cpvl_lgic) \
+	X(INSTRUCTION_FUSE_CMP_JMP, cmp_jmp) \
+	X(INSTRUCTION_FUSE_LOOP_COPY, loop_copy) \
+	X(INSTRUCTION_FUSE_LOOP_FILL, loop_fill) \
+	X(INSTRUCTION_FUSE_LOOP_CMP, loop_cmp)
+
+/* Opcodes of the fused instructions, rebuilt from their operands */
+#define instruction_fuse_opcode(id, oper1, oper2) ((id) | ((oper1) << 8) | ((oper2) << 16))
+#define INSTRUCTION_FUSE_OPCODE_JMP	0x06
+
+/* Step into the next instruction of a fused group. Returns 0 if the previous
+ * instruction did not complete, an interrupt was taken, the execution mode
+ * changed or the next instruction isn't mapped where it was decoded.
+ */
+static inline int instruction_fuse_next(leg_addr_t *rip, leg_addr_t *prip, uint8_t size, uint32_t opcode, int mode) {
+	*rip += size;
+	*prip += size;
+
+	if (regs.rip != *rip)
+		return 0;
+
+	/* Check for hardware interrupts, as the run loop would */
+	if (regs.rst & REG_RST_BIT_INTR) {
+		interrupt_hw_check();
+
+		if (regs.rip != *rip)
+			return 0;
+	}
+
+	if (instruction_mode(regs.rst) != mode)
+		return 0;
+
+	/* Fused instructions may cross a page boundary */
+	if ((mode & INSTRUCTION_MODE_PAGING) && (paging_get_paddr(*rip, PAGE_PERM_EXEC) != *prip))
+		return 0;
+
+	run.opcode = opcode;
+	run.icount++;
+
+	return 1;
+}
+
+/* Loop idioms. Guest kernels copy, clear and compare memory one word at a
+ * time, with the loop bodies below followed by a jmp back to their first
+ * instruction. Registers are bound to slots on first use, and distinct slots
+ * must hold distinct general purpose registers. The slot compared by a copy
+ * or fill loop must be one of its pointers.
+ */
+enum {
+	INSTRUCTION_LOOP_SRC,
+	INSTRUCTION_LOOP_DST,
+	INSTRUCTION_LOOP_TMP,
+	INSTRUCTION_LOOP_TMP2,
+	INSTRUCTION_LOOP_STEP,
+	INSTRUCTION_LOOP_END,
+	INSTRUCTION_LOOP_CNT
+};
+
+#define INSTRUCTION_LOOP_INSNS_MAX	5
+
+struct instruction_loop {
+	uint8_t count;		/* Instructions before the jmp */
+	uint8_t insn[INSTRUCTION_LOOP_INSNS_MAX][3]; /* ID and operand slots */
+};
+
+static const struct instruction_loop instruction_loop[] = {
+	[INSTRUCTION_FUSE_LOOP_COPY - INSTRUCTION_FUSE_LOOP_COPY] = { 5, {
+		{ 0x03, INSTRUCTION_LOOP_SRC, INSTRUCTION_LOOP_TMP },	/* cpr <src>, <tmp> */
+		{ 0x04, INSTRUCTION_LOOP_TMP, INSTRUCTION_LOOP_DST },	/* cprr <tmp>, <dst> */
+		{ 0x09, INSTRUCTION_LOOP_STEP, INSTRUCTION_LOOP_SRC },	/* arth <step>, <src> */
+		{ 0x09, INSTRUCTION_LOOP_STEP, INSTRUCTION_LOOP_DST },	/* arth <step>, <dst> */
+		{ 0x05, INSTRUCTION_LOOP_CNT, INSTRUCTION_LOOP_END } } },	/* cmp <src|dst>, <end> */
+	[INSTRUCTION_FUSE_LOOP_FILL - INSTRUCTION_FUSE_LOOP_COPY] = { 3, {
+		{ 0x04, INSTRUCTION_LOOP_TMP, INSTRUCTION_LOOP_DST },	/* cprr <val>, <dst> */
+		{ 0x09, INSTRUCTION_LOOP_STEP, INSTRUCTION_LOOP_DST },	/* arth <step>, <dst> */
+		{ 0x05, INSTRUCTION_LOOP_CNT, INSTRUCTION_LOOP_END } } },	/* cmp <dst>, <end> */
+	[INSTRUCTION_FUSE_LOOP_CMP - INSTRUCTION_FUSE_LOOP_COPY] = { 5, {
+		{ 0x03, INSTRUCTION_LOOP_SRC, INSTRUCTION_LOOP_TMP },	/* cpr <src>, <tmp> */
+		{ 0x03, INSTRUCTION_LOOP_DST, INSTRUCTION_LOOP_TMP2 },	/* cpr <dst>, <tmp2> */
+		{ 0x09, INSTRUCTION_LOOP_STEP, INSTRUCTION_LOOP_SRC },	/* arth <step>, <src> */
+		{ 0x09, INSTRUCTION_LOOP_STEP, INSTRUCTION_LOOP_DST },	/* arth <step>, <dst> */
+		{ 0x05, INSTRUCTION_LOOP_TMP, INSTRUCTION_LOOP_TMP2 } } },	/* cmp <tmp>, <tmp2> (EQ) */
+};
+
+#define instruction_loop_reg(d, slot) (*(leg_addr_t *) regs_list[(d)->loop_reg[slot] / 4])
+
+/* Number of iterations left for a copy or fill loop, including the current
+ * one, or 0 if unknown.
+ */
+static inline uint64_t instruction_loop_count(const struct decode *d) {
+	leg_addr_t cnt = instruction_loop_reg(d, INSTRUCTION_LOOP_CNT);
+	leg_addr_t end = instruction_loop_reg(d, INSTRUCTION_LOOP_END);
+
+	switch (regs.rcmp & (REG_RCMP_BIT_NE | REG_RCMP_BIT_GT | REG_RCMP_BIT_LT | REG_RCMP_BIT_EQ)) {
+		case REG_RCMP_BIT_LT:
+			return (end > cnt) ? ((uint64_t) end - cnt + 3) >> 2 : 1;
+		case REG_RCMP_BIT_NE:
+			/* Loops that would wrap around are left to the handlers */
+			return ((end > cnt) && !((end - cnt) & 3)) ? (end - cnt) >> 2 : 0;
+	}
+
+	return 0;
+}
+
+/* Grant that [addr, addr + size) is in the normal zone, without faulting */
+static inline int instruction_loop_grant(leg_addr_t addr, uint64_t size) {
+	return (addr >= MM_ZONE_NORMAL) && (((uint64_t) addr + size) <= config.vm.ram);
+}
+
+/* Run all but the last of the iterations left of a loop idiom on the host,
+ * up to INSTRUCTION_LOOP_CHUNK, through memmove(), memset() or memcmp().
+ * Nothing is done unless every skipped iteration would complete without
+ * faults, leaving the loop itself unchanged. The last iteration sets the
+ * registers and flags it leaves behind, so it always runs on the handlers.
+ */
+static inline void instruction_loop_skip(const struct decode *d, int kind) {
+	const struct instruction_loop *l = &instruction_loop[kind - INSTRUCTION_FUSE_LOOP_COPY];
+	leg_addr_t rarth = regs.rarth & ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF);
+	leg_addr_t src = 0, dst = instruction_loop_reg(d, INSTRUCTION_LOOP_DST);
+	uint64_t n, i, size;
+	uint32_t val;
+
+	/* Pointers must advance by a word on each iteration */
+	if ((rarth & (REG_ARTH_BIT_MUL | REG_ARTH_BIT_DIV | REG_ARTH_BIT_SUB | REG_ARTH_BIT_ADD | REG_ARTH_BIT_MOD | REG_ARTH_BIT_8BITOP | REG_ARTH_BIT_16BITOP | REG_ARTH_BIT_32BITOP)) != REG_ARTH_BIT_ADD)
+		return;
+
+	if (instruction_loop_reg(d, INSTRUCTION_LOOP_STEP) != (ARCH_ADDR_BITS >> 3))
+		return;
+
+	if (kind != INSTRUCTION_FUSE_LOOP_FILL)
+		src = instruction_loop_reg(d, INSTRUCTION_LOOP_SRC);
+
+	if (kind == INSTRUCTION_FUSE_LOOP_CMP) {
+		if ((regs.rcmp & (REG_RCMP_BIT_NE | REG_RCMP_BIT_GT | REG_RCMP_BIT_LT | REG_RCMP_BIT_EQ)) != REG_RCMP_BIT_EQ)
+			return;
+
+		if ((src < MM_ZONE_NORMAL) || (dst < MM_ZONE_NORMAL) || (src >= config.vm.ram) || (dst >= config.vm.ram))
+			return;
+
+		/* Words available to both pointers, the last one is left */
+		n = (config.vm.ram - (src > dst ? src : dst)) >> 2;
+
+		if (n > INSTRUCTION_LOOP_CHUNK + 1)
+			n = INSTRUCTION_LOOP_CHUNK + 1;
+
+		if (n < 2)
+			return;
+
+		/* Stop before the first mismatch, which ends the loop */
+		if (memcmp(mm_ptr(src), mm_ptr(dst), (n - 1) << 2)) {
+			for (n = 0; mm_load32(src + (n << 2)) == mm_load32(dst + (n << 2)); n++);
+
+			n++;
+		}
+	} else {
+		if ((n = instruction_loop_count(d)) > INSTRUCTION_LOOP_CHUNK + 1)
+			n = INSTRUCTION_LOOP_CHUNK + 1;
+
+		if (n < 2)
+			return;
+
+		size = (n - 1) << 2;
+
+		if (!instruction_loop_grant(dst, size))
+			return;
+
+		/* Writes must not reach the loop */
+		if ((dst < (d->paddr + d->span)) && (((uint64_t) dst + size) > d->paddr))
+			return;
+
+		if (kind == INSTRUCTION_FUSE_LOOP_COPY) {
+			if (!instruction_loop_grant(src, size))
+				return;
+
+			/* Word by word copies only match memmove() when moving
+			 * data down or to a disjoint range
+			 */
+			if ((dst > src) && (dst < ((uint64_t) src + size)))
+				return;
+
+			memmove(mm_ptr(dst), mm_ptr(src), size);
+		} else {
+			val = instruction_loop_reg(d, INSTRUCTION_LOOP_TMP);
+
+			if (val == ((val & 0xFF) * 0x01010101)) {
+				memset(mm_ptr(dst), val & 0xFF, size);
+			} else {
+				for (i = 0; i < size; i += 4)
+					mm_store32(dst + i, val);
+			}
+		}
+
+		/* Drop any cached decode of overwritten code */
+		decode_invalidate(dst, size);
+	}
+
+	/* State at the start of the last iteration */
+	if (kind != INSTRUCTION_FUSE_LOOP_FILL)
+		instruction_loop_reg(d, INSTRUCTION_LOOP_SRC) = src + ((n - 1) << 2);
+
+	instruction_loop_reg(d, INSTRUCTION_LOOP_DST) = dst + ((n - 1) << 2);
+
+	run.icount += (n - 1) * (l->count + 1);
+}
+
+static inline void _loop(const struct decode *d, int kind, int mode) {
+	const struct instruction_loop *l = &instruction_loop[kind - INSTRUCTION_FUSE_LOOP_COPY];
+	leg_addr_t rip = regs.rip, prip = d->paddr, oper1, oper2;
+	int i;
+
+#ifndef DEBUG
+	/* Host memory is only contiguous with paging disabled */
+	if (!(mode & INSTRUCTION_MODE_PAGING))
+		instruction_loop_skip(d, kind);
+#endif
+
+	/* Run one iteration through the handlers */
+	for (i = 0; i < l->count; i++) {
+		if (i && !instruction_fuse_next(&rip, &prip, ARCH_ADDR_BITS >> 3, instruction_fuse_opcode(l->insn[i][0], d->loop_reg[l->insn[i][1]], d->loop_reg[l->insn[i][2]]), mode))
+			return;
+
+		oper1 = d->loop_reg[l->insn[i][1]];
+		oper2 = d->loop_reg[l->insn[i][2]];
+
+		switch (l->insn[i][0]) {
+			case 0x03: _cpr("cpr", oper1, oper2, ARCH_ADDR_BITS >> 3, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode); break;
+			case 0x04: _cprr("cprr", oper1, oper2, ARCH_ADDR_BITS >> 3, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode); break;
+			case 0x05: _cmp("cmp", oper1, oper2, ARCH_ADDR_BITS >> 3, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode); break;
+			case 0x09: _arth("arth", oper1, oper2, ARCH_ADDR_BITS >> 3, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode); break;
+		}
+	}
+
+	/* Branch back while the comparison holds */
+	if (!instruction_fuse_next(&rip, &prip, ARCH_ADDR_BITS >> 3, INSTRUCTION_FUSE_OPCODE_JMP, mode))
+		return;
+
+	jmp(d->fuse_oper[2], 0, 2 * (ARCH_ADDR_BITS >> 3), OPERAND_TYPE_LIT, OPERAND_TYPE_REG);
+}
+
+static inline void _fused(const struct decode *d, int kind, int mode) {
+	leg_addr_t rip = regs.rip, prip = d->paddr;
+	uint8_t size = d->size;
+
+	if (kind >= INSTRUCTION_FUSE_LOOP_COPY) {
+		_loop(d, kind, mode);
+		return;
+	}
+
+	if (kind == INSTRUCTION_FUSE_CMP_JMP) {
+		_cmp("cmp", d->oper1, d->oper2, size, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode);
+	} else {
+		/* Configure RCMP, RARTH or RLGIC ... */
+		_cpvl("cpvl", d->oper1, d->oper2, size, OPERAND_TYPE_LIT, OPERAND_TYPE_REG, 1, mode);
+
+		size = ARCH_ADDR_BITS >> 3;
+
+		/* ... and run the instruction using it */
+		if (kind == INSTRUCTION_FUSE_CPVL_ARTH) {
+			if (instruction_fuse_next(&rip, &prip, d->size, instruction_fuse_opcode(0x09, d->fuse_oper[0], d->fuse_oper[1]), mode))
+				_arth("arth", d->fuse_oper[0], d->fuse_oper[1], size, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode);
+
+			return;
+		}
+
+		if (kind == INSTRUCTION_FUSE_CPVL_LGIC) {
+			if (instruction_fuse_next(&rip, &prip, d->size, instruction_fuse_opcode(0x0A, d->fuse_oper[0], d->fuse_oper[1]), mode))
+				_lgic("lgic", d->fuse_oper[0], d->fuse_oper[1], size, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode);
+
+			return;
+		}
+
+		if (!instruction_fuse_next(&rip, &prip, d->size, instruction_fuse_opcode(0x05, d->fuse_oper[0], d->fuse_oper[1]), mode))
+			return;
+
+		_cmp("cmp", d->fuse_oper[0], d->fuse_oper[1], size, OPERAND_TYPE_REG, OPERAND_TYPE_REG, 1, mode);
+
+		if (kind == INSTRUCTION_FUSE_CPVL_CMP)
+			return;
+	}
+
+	/* Branch on the comparison result */
+	if (!instruction_fuse_next(&rip, &prip, size, INSTRUCTION_FUSE_OPCODE_JMP, mode))
+		return;
+
+	jmp(d->fuse_oper[2], 0, 2 * (ARCH_ADDR_BITS >> 3), OPERAND_TYPE_LIT, OPERAND_TYPE_REG);
+}
+
+#define INSTRUCTION_FUSED_MODE(kind, sfx, msfx, mode) \
+static void fused_##sfx##_##msfx(const struct decode *d) { \
+	_fused(d, kind, mode); \
+}
+
+#define INSTRUCTION_FUSED(kind, sfx) \
+	INSTRUCTION_FUSED_MODE(kind, sfx, pl0, 0) \
+	INSTRUCTION_FUSED_MODE(kind, sfx, pl0pg, INSTRUCTION_MODE_PAGING) \
+	INSTRUCTION_FUSED_MODE(kind, sfx, pl1, INSTRUCTION_MODE_LOWPRIV) \
+	INSTRUCTION_FUSED_MODE(kind, sfx, pl1pg, INSTRUCTION_MODE_LOWPRIV | INSTRUCTION_MODE_PAGING)
+
+INSTRUCTION_FUSIONS(INSTRUCTION_FUSED)
+
+#define INSTRUCTION_FUSED_PL0(kind, sfx) [kind] = &fused_##sfx##_pl0,
+#define INSTRUCTION_FUSED_PL0PG(kind, sfx) [kind] = &fused_##sfx##_pl0pg,
+#define INSTRUCTION_FUSED_PL1(kind, sfx) [kind] = &fused_##sfx##_pl1,
+#define INSTRUCTION_FUSED_PL1PG(kind, sfx) [kind] = &fused_##sfx##_pl1pg,
+
+void (*const instruction_fused[INSTRUCTION_MODES][INSTRUCTION_FUSE_MAX]) (const struct decode *) = {
+	[0] = { INSTRUCTION_FUSIONS(INSTRUCTION_FUSED_PL0) },
+	[INSTRUCTION_MODE_PAGING] = { INSTRUCTION_FUSIONS(INSTRUCTION_FUSED_PL0PG) },
+	[INSTRUCTION_MODE_LOWPRIV] = { INSTRUCTION_FUSIONS(INSTRUCTION_FUSED_PL1) },
+	[INSTRUCTION_MODE_LOWPRIV | INSTRUCTION_MODE_PAGING] = { INSTRUCTION_FUSIONS(INSTRUCTION_FUSED_PL1PG) },
+};
+
+/* Returns 1 if the instruction at paddr is a jmp to a literal address */
+static int instruction_fuse_jmp(leg_addr_t paddr, struct decode *jd) {
+	if (decode_peek(paddr, jd) < 0)
+		return 0;
+
+	return (jd->opcode == INSTRUCTION_FUSE_OPCODE_JMP) && operand_islit(jd->oper1_type);
+}
+
+/* Returns 1 if the instructions at d form the given loop idiom, binding
+ * its registers and target to d.
+ */
+static int instruction_fuse_loop(struct decode *d, int kind) {
+	const struct instruction_loop *l = &instruction_loop[kind - INSTRUCTION_FUSE_LOOP_COPY];
+	uint8_t reg[DECODE_LOOP_REGS] = { 0 };	/* REG_RIP marks unbound slots */
+	leg_addr_t paddr = d->paddr, oper;
+	struct decode next = *d;
+	int i, j, k;
+
+	for (i = 0; i < l->count; i++) {
+		if (i && (decode_peek(paddr, &next) < 0))
+			return 0;
+
+		/* Only the canonical encodings can be rebuilt from operands */
+		if ((next.id != l->insn[i][0]) || !operand_isreg(next.oper1_type) || !operand_isreg(next.oper2_type) || (next.opcode >> 24))
+			return 0;
+
+		for (j = 1; j <= 2; j++) {
+			oper = (j == 1) ? next.oper1 : next.oper2;
+
+			if (!reg[l->insn[i][j]])
+				reg[l->insn[i][j]] = oper;
+			else if (reg[l->insn[i][j]] != oper)
+				return 0;
+		}
+
+		paddr += next.size;
+	}
+
+	/* Branch back to the start */
+	if (!instruction_fuse_jmp(paddr, &next) || (next.oper1 != d->paddr))
+		return 0;
+
+	/* Slots hold distinct general purpose registers */
+	for (j = 0; j < INSTRUCTION_LOOP_CNT; j++) {
+		if (!reg[j])
+			continue;
+
+		if ((reg[j] < REG_RGP1) || (reg[j] > REG_RGP8))
+			return 0;
+
+		for (k = j + 1; k < INSTRUCTION_LOOP_CNT; k++) {
+			if (reg[j] == reg[k])
+				return 0;
+		}
+	}
+
+	if (reg[INSTRUCTION_LOOP_CNT] && (reg[INSTRUCTION_LOOP_CNT] != reg[INSTRUCTION_LOOP_SRC]) && (reg[INSTRUCTION_LOOP_CNT] != reg[INSTRUCTION_LOOP_DST]))
+		return 0;
+
+	d->fused = kind;
+	d->fuse_oper[2] = next.oper1;
+	d->span = paddr + next.size - d->paddr;
+	memcpy(d->loop_reg, reg, sizeof(reg));
+
+	return 1;
+}
+
+void instruction_fuse(struct decode *d) {
+	struct decode next;
+
+	switch (d->variant) {
+		case INSTRUCTION_cpvl_lr: {
+			uint8_t variant;
+
+			/* The configured register selects the consumer */
+			switch (d->oper2) {
+				case REG_RCMP: d->fused = INSTRUCTION_FUSE_CPVL_CMP; variant = INSTRUCTION_cmp_rr; break;
+				case REG_RARTH: d->fused = INSTRUCTION_FUSE_CPVL_ARTH; variant = INSTRUCTION_arth_rr; break;
+				case REG_RLGIC: d->fused = INSTRUCTION_FUSE_CPVL_LGIC; variant = INSTRUCTION_lgic_rr; break;
+				default: return;
+			}
+
+			/* Only the canonical encoding can be rebuilt from operands */
+			if ((decode_peek(d->paddr + d->size, &next) < 0) || (next.variant != variant) || (next.opcode >> 24)) {
+				d->fused = INSTRUCTION_FUSE_NONE;
+				return;
+			}
+
+			d->fuse_oper[0] = next.oper1;
+			d->fuse_oper[1] = next.oper2;
+			d->span = d->size + next.size;
+
+			/* Also take the conditional jump of a comparison */
+			if ((d->fused == INSTRUCTION_FUSE_CPVL_CMP) && instruction_fuse_jmp(d->paddr + d->span, &next)) {
+				d->fused = INSTRUCTION_FUSE_CPVL_CMP_JMP;
+				d->fuse_oper[2] = next.oper1;
+				d->span += next.size;
+			}
+
+			break;
+		}
+		case INSTRUCTION_cmp_rr: {
+			if (!instruction_fuse_jmp(d->paddr + d->size, &next))
+				return;
+
+			d->fused = INSTRUCTION_FUSE_CMP_JMP;
+			d->fuse_oper[2] = next.oper1;
+			d->span = d->size + next.size;
+
+			break;
+		}
+		case INSTRUCTION_cpr_rr: {
+			if (!instruction_fuse_loop(d, INSTRUCTION_FUSE_LOOP_COPY))
+				instruction_fuse_loop(d, INSTRUCTION_FUSE_LOOP_CMP);
+
+			break;
+		}
+		case INSTRUCTION_cprr_rr: {
+			instruction_fuse_loop(d, INSTRUCTION_FUSE_LOOP_FILL);
+
+			break;
+		}
+	}
+}
@@ -34,6 +34,9 @@
 #include "vm.h"
 #include "debug.h"
 #include "pqueue.h"
+#include "decode.h"
+#include "bcache.h"
+#include "overlay.h"
 
 /* Interrupt vector
  *
@@ -44,6 +47,8 @@
 volatile struct intrv_entry intrv[INTERRUPT_VECTOR_SIZE] = { [ 0 ... INTERRUPT_VECTOR_SIZE - 1] = { 0, 0 } };
 
 void interrupt_hw_check(void) {
+	leg_addr_t tag, status;
+
 	if (!(regs.rst & REG_RST_BIT_INTR))
 		return;
 
@@ -63,6 +68,16 @@ void interrupt_hw_check(void) {
 		interrupt_int10((uint8_t) pq->msg_buf.data[0]);
 	}
 
+	/* Check for asynchronous storage I/O completion. One is delivered per
+	 * check, as each overwrites the registers of the previous one.
+	 */
+	if (io_storage_complete(&tag, &status)) {
+#ifdef DEBUG
+		debug_interrupt_caught(INTR_12);
+#endif
+		interrupt_int12(tag, status);
+	}
+
 }
 
 void interrupt_intvr_handler(uint8_t intr) {
@@ -201,7 +216,8 @@ void interrupt_int0b(
 		leg_addr_t rgp2,
 		leg_addr_t rgp3,
 		leg_addr_t addr,
-		leg_addr_t rgp5) {
+		leg_addr_t rgp5,
+		leg_addr_t rgp6) {
 	uint64_t offset;
 
 	/* Privilege Level Check */
@@ -219,9 +235,16 @@ void interrupt_int0b(
 			return;
 	}
 
-	if (!mm_grant_zone_normal(addr))
+	/* Storage is accessed by the host, so RAM bounds must be checked */
+	if (!mm_grant_zone_normal_io(addr))
 		return;
 
+	if (((uint64_t) addr + rgp3) > config.vm.ram) {
+		regs.rff |= 0x0B << 24;
+		fault_bad_mm(addr + rgp3);
+		return;
+	}
+
 	regs.rff &= ~FAULT_INTR;
 
 	if ((rgp1 & 0xFFFF) > sizeof(io.fdstor)) {
@@ -233,7 +256,20 @@ void interrupt_int0b(
 		return;
 	}
 
-	if (rgp1 & 0x10000) {
+	if ((rgp1 & 0x80000) && (rgp1 & 0x30000)) {
+		offset = rgp2;
+
+		if (rgp1 & 0x40000)
+			offset |= ((uint64_t) rgp5) << 32;
+
+		/* Completion is delivered by INTR_12 */
+		if (io_storage_submit(rgp1 & 0xFFFF, addr, offset, rgp3, !!(rgp1 & 0x10000), rgp6) < 0) {
+			regs.rff |= FAULT_INTR;
+			regs.rff |= 0x0B << 24;
+			fault_io_op();
+			return;
+		}
+	} else if (rgp1 & 0x10000) {
 		if (rgp1 & 0x40000) {
 			offset = (((uint64_t) rgp5) << 32) | rgp2;
 			if (io_storage_read_extended(rgp1 & 0xFFFF, addr, offset, rgp3) < 0) {
@@ -304,7 +340,13 @@ void interrupt_int0d(leg_addr_t rgp1) {
 		task_load_rbt();
 	}
 
-	/* TODO: Implement page caching */
+	/* Drop cached translations to the page at physical base address RGP1,
+	 * or all of them if RGP1 is zero.
+	 */
+	if (rgp1)
+		paging_tlb_invalidate(rgp1);
+	else
+		paging_tlb_flush();
 
 	/* Non-Trappable */
 }
@@ -364,3 +406,221 @@ void interrupt_int10(uint8_t rgp1) {
 		regs.rip = intrv[0x10 - 1].handler_addr;
 }
 
+void interrupt_int11(leg_addr_t rgp1, leg_addr_t rgp2, leg_addr_t rgp3) {
+	/* Privilege Level Check */
+	if (privilege_get_current()) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x11 << 24;
+		fault_no_priv();
+		return;
+	}
+
+	regs.rff |= FAULT_INTR;
+
+	/* RAM is released by the host, so bounds must be checked */
+	if (!mm_grant_zone_normal_io(rgp2))
+		return;
+
+	if (((uint64_t) rgp2 + rgp3) > config.vm.ram) {
+		regs.rff |= 0x11 << 24;
+		fault_bad_mm(rgp2 + rgp3);
+		return;
+	}
+
+	regs.rff &= ~FAULT_INTR;
+
+	if (rgp1 == 0x01) {
+		if (mm_balloon_inflate(rgp2, rgp3) < 0) {
+			regs.rff |= FAULT_INTR;
+			regs.rff |= 0x11 << 24;
+			fault_mc(); // Machine Check Fault if the host refuses
+			return;
+		}
+
+		/* Released RAM no longer holds the code decoded from it */
+		decode_invalidate(rgp2, rgp3);
+	} else if (rgp1 == 0x02) {
+		mm_balloon_deflate(rgp2, rgp3);
+	} else {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x11 << 24;
+		fault_bad_oper_val(rgp1);
+		return;
+	}
+
+	/* Properly set RGP1 with the balloon size */
+	regs.rgp1 = mm_balloon.bytes;
+
+	/* Update RIP before context switch */
+	regs.rip += (ARCH_ADDR_BITS >> 3);
+
+	/* Context switch */
+	if (regs.rst & REG_RST_BIT_TSK) {
+		task_save_rct();
+		task_load_rbt();
+	}
+
+	/* Non-Trappable */
+}
+
+void interrupt_int12(leg_addr_t tag, leg_addr_t status) {
+	/* Context switch */
+	if (regs.rst & REG_RST_BIT_TSK) {
+		task_save_rct();
+		task_load_rbt();
+	}
+
+	/* Properly set RGP1 with the request tag and RGP2 with its status */
+	regs.rgp1 = tag;
+	regs.rgp2 = status;
+
+	/* Trappable */
+	if (intrv[0x12 - 1].handler_addr)
+		regs.rip = intrv[0x12 - 1].handler_addr;
+}
+
+void interrupt_int13(leg_addr_t rgp1, leg_addr_t rgp2) {
+	/* Privilege Level Check */
+	if (privilege_get_current()) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x13 << 24;
+		fault_no_priv();
+		return;
+	}
+
+	regs.rff |= FAULT_INTR;
+
+	/* Descriptors are accessed by the host, so bounds must be checked */
+	if (!mm_grant_zone_normal_io(rgp1))
+		return;
+
+	if (((uint64_t) rgp1 + (uint64_t) rgp2 * IO_DESC_SIZE) > config.vm.ram) {
+		regs.rff |= 0x13 << 24;
+		fault_bad_mm(rgp1 + rgp2 * IO_DESC_SIZE);
+		return;
+	}
+
+	regs.rff &= ~FAULT_INTR;
+
+	/* Properly set RGP1 with the number of failed descriptors */
+	regs.rgp1 = io_storage_queue(rgp1, rgp2);
+
+	/* Update RIP before context switch */
+	regs.rip += (ARCH_ADDR_BITS >> 3);
+
+	/* Context switch */
+	if (regs.rst & REG_RST_BIT_TSK) {
+		task_save_rct();
+		task_load_rbt();
+	}
+
+	/* Non-Trappable */
+}
+
+void interrupt_int14(
+		leg_addr_t rgp1,
+		leg_addr_t rgp2,
+		leg_addr_t rgp3,
+		leg_addr_t addr,
+		leg_addr_t rgp5) {
+	uint64_t offset = rgp2;
+	int ret;
+
+	/* Privilege Level Check */
+	if (privilege_get_current()) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x14 << 24;
+		fault_no_priv();
+		return;
+	}
+
+	regs.rff |= FAULT_INTR;
+
+	/* The window replaces RAM, so bounds must be checked */
+	if (!mm_grant_zone_normal_io(addr))
+		return;
+
+	regs.rff &= ~FAULT_INTR;
+
+	if (((rgp1 & 0xFFFF) >= HW_STOR_MAX) || !config.vm.stor[rgp1 & 0xFFFF]) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x14 << 24;
+		fault_bad_oper_val(rgp1);
+		return;
+	}
+
+	if (rgp1 & 0x40000)
+		offset |= ((uint64_t) rgp5) << 32;
+
+	if (rgp1 & 0x10000) {
+		/* Stores through the window bypass the block cache. Overlays
+		 * only map their own file, so the range is copied up first.
+		 * Neither is done for windows that can't be mapped.
+		 */
+		if (!(ret = mm_window_check(addr, rgp3, offset)) && !(ret = bcache_sync(rgp1 & 0xFFFF, offset, rgp3, 1)))
+			ret = overlay_copyup(rgp1 & 0xFFFF, offset, rgp3);
+
+		if (!ret)
+			ret = mm_window_map(addr, rgp3, io.fdstor[rgp1 & 0xFFFF], offset);
+	} else if (rgp1 & 0x20000) {
+		ret = mm_window_unmap(addr, rgp3);
+	} else if (rgp1 & 0x80000) {
+		ret = mm_window_sync(addr, rgp3);
+	} else {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x14 << 24;
+		fault_bad_oper_val(rgp1);
+		return;
+	}
+
+	if (ret < 0) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x14 << 24;
+		fault_io_op();
+		return;
+	}
+
+	/* Drop any cached decode of replaced RAM */
+	if (!(rgp1 & 0x80000))
+		decode_invalidate(addr, rgp3);
+
+	/* Update RIP before context switch */
+	regs.rip += (ARCH_ADDR_BITS >> 3);
+
+	/* Context switch */
+	if (regs.rst & REG_RST_BIT_TSK) {
+		task_save_rct();
+		task_load_rbt();
+	}
+
+	/* Non-Trappable */
+}
+
+void interrupt_int15(void) {
+	/* Privilege Level Check */
+	if (privilege_get_current()) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x15 << 24;
+		fault_no_priv();
+		return;
+	}
+
+	/* Write back the stores held by the block cache */
+	if (bcache_flush() < 0) {
+		regs.rff |= FAULT_INTR;
+		regs.rff |= 0x15 << 24;
+		fault_io_op();
+		return;
+	}
+
+	/* Update RIP before context switch */
+	regs.rip += (ARCH_ADDR_BITS >> 3);
+
+	/* Context switch */
+	if (regs.rst & REG_RST_BIT_TSK) {
+		task_save_rct();
+		task_load_rbt();
+	}
+
+	/* Non-Trappable */
+}
@@ -20,16 +20,60 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 
 #include "config.h"
 #include "archdefs.h"
 #include "io.h"
 #include "interrupt.h"
 #include "mm.h"
+#include "decode.h"
+#include "aot.h"
 #include "debug.h"
 #include "pqueue.h"
+#include "bcache.h"
+#include "overlay.h"
+
+#if IO_URING
+ #include <sys/syscall.h>
+ #include <linux/io_uring.h>
+#endif
+
+/* Asynchronous request slot */
+struct io_async {
+	leg_addr_t tag;
+	leg_addr_t addr;
+	uint64_t offset;
+	size_t size;
+	uint16_t storid;
+	int read;
+	int ring;		/* Submitted to the io_uring */
+	int busy;		/* Submitted and not yet delivered */
+	int done;		/* Completed, status is valid */
+	int status;
+};
+
+#if IO_URING
+/* Rings shared with the host kernel */
+struct io_uring {
+	int fd;
+	unsigned int *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static struct io_uring _io_uring = { .fd = -1 };
+#endif
+
+static struct io_async _io_async[IO_ASYNC_MAX];
+static unsigned int _io_async_count;	/* Busy slots */
 
 volatile struct io io;
 
@@ -46,6 +90,11 @@ static void _io_storage_init(void) {
 			printf("Failed to open storage ID '%d': %m\n", i);
 			exit(EXIT_FAILURE);
 		}
+
+		if (overlay_init(i, config.vm.stor[i]) < 0) {
+			printf("Failed to open the base image or map of storage ID '%d': %m\n", i);
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	if (!count) {
@@ -67,6 +116,51 @@ static void _io_storage_destroy(void) {
 
 		close(io.fdstor[i]);
 	}
+
+	overlay_destroy();
+}
+
+/* Same semantics as pread(). Overlays are read through their base image. */
+ssize_t io_storage_pread(uint16_t storid, void *buf, size_t size, uint64_t offset) {
+	if (overlay_active(storid))
+		return overlay_read(storid, buf, size, offset);
+
+	return pread64(io.fdstor[storid], buf, size, offset);
+}
+
+ssize_t io_storage_pwrite(uint16_t storid, const void *buf, size_t size, uint64_t offset) {
+	if (overlay_active(storid))
+		return overlay_write(storid, buf, size, offset);
+
+	return pwrite64(io.fdstor[storid], buf, size, offset);
+}
+
+/* Same semantics as preadv() and pwritev() */
+static ssize_t _io_storage_vector(uint16_t storid, int read, const struct iovec *iov, unsigned int count, uint64_t offset) {
+	unsigned int i;
+	size_t done = 0;
+	ssize_t ret;
+
+	if (!overlay_active(storid))
+		return read ? preadv64(io.fdstor[storid], iov, count, offset) : pwritev64(io.fdstor[storid], iov, count, offset);
+
+	/* Overlays split each request between their layers anyway */
+	for (i = 0; i < count; i++) {
+		if (read)
+			ret = overlay_read(storid, iov[i].iov_base, iov[i].iov_len, offset + done);
+		else
+			ret = overlay_write(storid, iov[i].iov_base, iov[i].iov_len, offset + done);
+
+		if (ret < 0)
+			return done ? done : -1;
+
+		done += ret;
+
+		if (ret != iov[i].iov_len)
+			break;
+	}
+
+	return done;
 }
 
 int io_display_write(uint8_t byte) {
@@ -81,51 +175,429 @@ int io_display_write(uint8_t byte) {
 	return 0;
 }
 
+/* Watched and tracked RAM is write protected, so reads are let through
+ * explicitly
+ */
+static ssize_t _io_storage_read_mm(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size) {
+	ssize_t ret;
+
+	mm_dirty_io(addr, size);
+	mm_watch_io_begin(addr, size);
+	ret = bcache_read(storid, mm_ptr(addr), size, offset);
+
+	/* Share the pages of boot images with other VMs */
+	if (ret == size)
+		aot_share(storid, offset, size, addr);
+
+	mm_watch_io_end(addr, size);
+
+	return ret;
+}
+
 int io_storage_write_extended(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size) {
-	if (lseek64(io.fdstor[storid], offset, SEEK_SET) < 0)
+	if (bcache_write(storid, mm_ptr(addr), size, offset) != size)
 		return -1;
 
-	if (write(io.fdstor[storid], (void *) (mm + addr), size) != size)
+	return 0;
+}
+
+int io_storage_write(uint16_t storid, leg_addr_t addr, size_t offset, size_t size) {
+	return io_storage_write_extended(storid, addr, offset, size);
+}
+
+static void _io_storage_read_done(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size) {
+	/* Drop any cached decode of overwritten code */
+	decode_invalidate(addr, size);
+
+	/* Decode loaded images ahead of time if cached */
+	aot_load(storid, offset, size, addr);
+}
+
+int io_storage_read_extended(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size) {
+	if (_io_storage_read_mm(storid, addr, offset, size) != size)
 		return -1;
 
+	_io_storage_read_done(storid, addr, offset, size);
+
 	return 0;
 }
 
-int io_storage_write(uint16_t storid, leg_addr_t addr, size_t offset, size_t size) {
-	if (lseek(io.fdstor[storid], offset, SEEK_SET) < 0)
+int io_storage_read(uint16_t storid, leg_addr_t addr, size_t offset, size_t size) {
+	return io_storage_read_extended(storid, addr, offset, size);
+}
+
+/* Storage descriptor, in host byte order */
+struct io_desc {
+	uint16_t storid;
+	int read;
+	uint64_t offset;
+	size_t size;
+	leg_addr_t addr;
+};
+
+/* Returns -1 if the descriptor at addr can't be served */
+static int _io_desc_load(leg_addr_t addr, struct io_desc *d) {
+	uint32_t flags = mm_load32(addr + IO_DESC_FLAGS);
+
+	d->storid = flags & 0xFFFF;
+	d->read = !!(flags & 0x10000);
+	d->offset = (((uint64_t) mm_load32(addr + IO_DESC_OFFSET_HI)) << 32) | mm_load32(addr + IO_DESC_OFFSET_LO);
+	d->size = mm_load32(addr + IO_DESC_LEN);
+	d->addr = mm_load32(addr + IO_DESC_ADDR);
+
+	if ((d->storid >= HW_STOR_MAX) || !config.vm.stor[d->storid])
+		return -1;
+
+	if (!(flags & 0x10000) == !(flags & 0x20000))
 		return -1;
 
-	if (write(io.fdstor[storid], (void *) (mm + addr), size) != size)
+	/* Buffers are accessed by the host */
+	if ((d->addr < MM_ZONE_NORMAL) || (((uint64_t) d->addr + d->size) > config.vm.ram))
 		return -1;
 
 	return 0;
 }
 
-int io_storage_read_extended(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size) {
-	if (lseek64(io.fdstor[storid], offset, SEEK_SET) < 0)
+static void _io_desc_status(leg_addr_t addr, uint32_t status) {
+	mm_store32(addr + IO_DESC_STATUS, status);
+	decode_write(addr + IO_DESC_STATUS, 4);
+}
+
+/* Serve count adjacent descriptors, starting with d, in a single host call.
+ * Returns the number of bytes transferred.
+ */
+static ssize_t _io_desc_serve(const struct io_desc *d, unsigned int count) {
+	struct iovec iov[IO_DESC_MERGE_MAX];
+	unsigned int i;
+	size_t size = 0;
+	ssize_t ret;
+
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = mm_ptr(d[i].addr);
+		iov[i].iov_len = d[i].size;
+		size += d[i].size;
+	}
+
+	/* Cached blocks must agree with storage */
+	if (bcache_sync(d->storid, d->offset, size, !d->read) < 0)
 		return -1;
 
-	if (read(io.fdstor[storid], (void *) (mm + addr), size) != size)
+	if (!d->read)
+		return _io_storage_vector(d->storid, 0, iov, count, d->offset);
+
+	for (i = 0; i < count; i++) {
+		mm_dirty_io(d[i].addr, d[i].size);
+		mm_watch_io_begin(d[i].addr, d[i].size);
+	}
+
+	ret = _io_storage_vector(d->storid, 1, iov, count, d->offset);
+
+	for (i = 0; i < count; i++)
+		mm_watch_io_end(d[i].addr, d[i].size);
+
+	return ret;
+}
+
+/* Serve the count storage descriptors at desc. Runs of requests to adjacent
+ * storage offsets are merged into a single host call. Returns the number of
+ * failed descriptors.
+ */
+leg_addr_t io_storage_queue(leg_addr_t desc, leg_addr_t count) {
+	struct io_desc d[IO_DESC_MERGE_MAX];
+	leg_addr_t i = 0, failed = 0;
+	unsigned int n, j;
+	ssize_t done;
+
+	while (i < count) {
+		if (_io_desc_load(desc + i * IO_DESC_SIZE, &d[0]) < 0) {
+			_io_desc_status(desc + i * IO_DESC_SIZE, 1);
+			failed++;
+			i++;
+			continue;
+		}
+
+		for (n = 1; (n < IO_DESC_MERGE_MAX) && ((i + n) < count); n++) {
+			if (_io_desc_load(desc + (i + n) * IO_DESC_SIZE, &d[n]) < 0)
+				break;
+
+			if ((d[n].storid != d[0].storid) || (d[n].read != d[0].read) || (d[n].offset != (d[n - 1].offset + d[n - 1].size)))
+				break;
+		}
+
+		done = _io_desc_serve(d, n);
+
+		/* Short transfers fail the descriptors they didn't cover */
+		for (j = 0; j < n; j++, i++) {
+			if (done >= (ssize_t) d[j].size) {
+				done -= d[j].size;
+
+				if (d[j].read)
+					_io_storage_read_done(d[j].storid, d[j].addr, d[j].offset, d[j].size);
+
+				_io_desc_status(desc + i * IO_DESC_SIZE, 0);
+			} else {
+				done = 0;
+				failed++;
+
+				_io_desc_status(desc + i * IO_DESC_SIZE, 1);
+			}
+		}
+	}
+
+	return failed;
+}
+
+#if IO_URING
+static void _io_uring_destroy(void) {
+	if (_io_uring.sqes)
+		munmap(_io_uring.sqes, _io_uring.sqes_size);
+
+	if (_io_uring.cq_ring && (_io_uring.cq_ring != _io_uring.sq_ring))
+		munmap(_io_uring.cq_ring, _io_uring.cq_ring_size);
+
+	if (_io_uring.sq_ring)
+		munmap(_io_uring.sq_ring, _io_uring.sq_ring_size);
+
+	if (_io_uring.fd >= 0)
+		close(_io_uring.fd);
+
+	memset(&_io_uring, 0, sizeof(_io_uring));
+	_io_uring.fd = -1;
+}
+
+static void *_io_uring_map(size_t size, off_t offset) {
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _io_uring.fd, offset);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+/* Returns -1 if the host has no io_uring supporting plain reads and writes */
+static int _io_uring_init(void) {
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+
+	if ((_io_uring.fd = syscall(__NR_io_uring_setup, IO_ASYNC_MAX, &p)) < 0)
 		return -1;
 
+	/* Plain read and write requests came along with this feature */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS))
+		goto _fail;
+
+	_io_uring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	_io_uring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Both rings share a single mapping */
+	if (_io_uring.cq_ring_size > _io_uring.sq_ring_size)
+		_io_uring.sq_ring_size = _io_uring.cq_ring_size;
+
+	if (!(_io_uring.sq_ring = _io_uring_map(_io_uring.sq_ring_size, IORING_OFF_SQ_RING)))
+		goto _fail;
+
+	_io_uring.cq_ring = _io_uring.sq_ring;
+
+	_io_uring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (!(_io_uring.sqes = _io_uring_map(_io_uring.sqes_size, IORING_OFF_SQES)))
+		goto _fail;
+
+	_io_uring.sq_tail = _io_uring.sq_ring + p.sq_off.tail;
+	_io_uring.sq_mask = _io_uring.sq_ring + p.sq_off.ring_mask;
+	_io_uring.sq_array = _io_uring.sq_ring + p.sq_off.array;
+	_io_uring.cq_head = _io_uring.cq_ring + p.cq_off.head;
+	_io_uring.cq_tail = _io_uring.cq_ring + p.cq_off.tail;
+	_io_uring.cq_mask = _io_uring.cq_ring + p.cq_off.ring_mask;
+	_io_uring.cqes = _io_uring.cq_ring + p.cq_off.cqes;
+
 	return 0;
+
+_fail:
+	_io_uring_destroy();
+
+	return -1;
 }
 
-int io_storage_read(uint16_t storid, leg_addr_t addr, size_t offset, size_t size) {
-	if (lseek(io.fdstor[storid], offset, SEEK_SET) < 0)
+static int _io_uring_submit(unsigned int slot) {
+	struct io_async *a = &_io_async[slot];
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *_io_uring.sq_tail, index = tail & *_io_uring.sq_mask;
+
+	sqe = &_io_uring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	sqe->opcode = a->read ? IORING_OP_READ : IORING_OP_WRITE;
+	sqe->fd = io.fdstor[a->storid];
+	sqe->addr = (uintptr_t) mm_ptr(a->addr);
+	sqe->len = a->size;
+	sqe->off = a->offset;
+	sqe->user_data = slot;
+
+	_io_uring.sq_array[index] = index;
+
+	/* The entry must be visible before the host sees the new tail */
+	__atomic_store_n(_io_uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (syscall(__NR_io_uring_enter, _io_uring.fd, 1, 0, 0, NULL, 0) != 1) {
+		__atomic_store_n(_io_uring.sq_tail, tail, __ATOMIC_RELEASE);
 		return -1;
+	}
+
+	return 0;
+}
+
+/* Mark the slots of completed requests as done */
+static void _io_uring_reap(void) {
+	struct io_uring_cqe *cqe;
+	struct io_async *a;
+	unsigned int head = *_io_uring.cq_head;
 
-	if (read(io.fdstor[storid], (void *) (mm + addr), size) != size)
+	while (head != __atomic_load_n(_io_uring.cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &_io_uring.cqes[head & *_io_uring.cq_mask];
+		a = &_io_async[cqe->user_data];
+
+		a->status = (cqe->res < 0) || ((size_t) cqe->res != a->size);
+		a->done = 1;
+
+		head++;
+	}
+
+	__atomic_store_n(_io_uring.cq_head, head, __ATOMIC_RELEASE);
+}
+#endif
+
+/* Start an asynchronous storage request. Its completion is reported by
+ * io_storage_complete() with the guest supplied tag.
+ */
+int io_storage_submit(uint16_t storid, leg_addr_t addr, uint64_t offset, size_t size, int read, leg_addr_t tag) {
+	struct io_async *a;
+	unsigned int slot;
+
+	if (_io_async_count == IO_ASYNC_MAX)
 		return -1;
 
+	for (slot = 0; _io_async[slot].busy; slot++);
+
+	a = &_io_async[slot];
+	a->tag = tag;
+	a->addr = addr;
+	a->offset = offset;
+	a->size = size;
+	a->storid = storid;
+	a->read = read;
+	a->ring = 0;
+	a->done = 0;
+
+#if IO_URING
+	/* Overlays split each request between their layers */
+	if ((_io_uring.fd >= 0) && !overlay_active(storid)) {
+		/* Cached blocks must agree with storage */
+		if (bcache_sync(storid, offset, size, !read) < 0)
+			return -1;
+
+		if (read) {
+			/* RAM stays writable until the request completes */
+			mm_dirty_io(addr, size);
+			mm_watch_io_begin(addr, size);
+		}
+
+		if (_io_uring_submit(slot) < 0) {
+			if (read)
+				mm_watch_io_end(addr, size);
+
+			return -1;
+		}
+
+		a->ring = 1;
+		a->busy = 1;
+		_io_async_count++;
+
+		return 0;
+	}
+#endif
+
+	if (read)
+		a->status = io_storage_read_extended(storid, addr, offset, size) < 0;
+	else
+		a->status = io_storage_write_extended(storid, addr, offset, size) < 0;
+
+	a->done = 1;
+	a->busy = 1;
+	_io_async_count++;
+
+	return 0;
+}
+
+/* Fetch the tag and status of a completed request. Returns 0 if none. */
+int io_storage_complete(leg_addr_t *tag, leg_addr_t *status) {
+	struct io_async *a;
+
+	if (!_io_async_count)
+		return 0;
+
+#if IO_URING
+	if (_io_uring.fd >= 0)
+		_io_uring_reap();
+#endif
+
+	for (a = _io_async; a < &_io_async[IO_ASYNC_MAX]; a++) {
+		if (!a->busy || !a->done)
+			continue;
+
+#if IO_URING
+		if (a->ring && a->read) {
+			if (!a->status)
+				aot_share(a->storid, a->offset, a->size, a->addr);
+
+			mm_watch_io_end(a->addr, a->size);
+
+			if (!a->status)
+				_io_storage_read_done(a->storid, a->addr, a->offset, a->size);
+		}
+#endif
+
+		*tag = a->tag;
+		*status = a->status;
+
+		a->busy = 0;
+		_io_async_count--;
+
+		return 1;
+	}
+
 	return 0;
 }
 
 void io_init(void) {
 	_io_storage_init();
+
+#if IO_URING
+	/* Asynchronous requests are performed synchronously without it */
+	_io_uring_init();
+#endif
 }
 
 void io_destroy(void) {
+#if IO_URING
+	unsigned int pending = 0;
+	struct io_async *a;
+
+	/* The host must be done with RAM before it is released */
+	if (_io_uring.fd >= 0) {
+		_io_uring_reap();
+
+		for (a = _io_async; a < &_io_async[IO_ASYNC_MAX]; a++)
+			pending += a->busy && !a->done;
+
+		if (pending)
+			syscall(__NR_io_uring_enter, _io_uring.fd, 0, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		_io_uring_destroy();
+	}
+#endif
+
+	/* Stores still cached reach storage before it is closed */
+	bcache_destroy();
+
 	_io_storage_destroy();
 }
 
@@ -0,0 +1,1090 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "archdefs.h"
+#include "config.h"
+#include "register.h"
+#include "instruction.h"
+#include "interrupt.h"
+#include "alu.h"
+#include "mm.h"
+#include "decode.h"
+#include "debug.h"
+#include "run.h"
+#include "jit.h"
+
+/* Basic block compiler from LEG32 to x86-64.
+ *
+ * Blocks are built for a single execution mode with paging disabled, so RIP
+ * is a physical address. At privilege level 0, register moves, cmp, arth
+ * and lgic between registers, cpr and cprr are compiled to native code,
+ * guarded on the RCMP, RARTH and RLGIC values expected at that point (as
+ * loaded by the block, or seen when compiling) and on the memory reference
+ * being in zone normal. Anything else, including a
+ * failed guard, calls the specialized handler of the interpreter. After
+ * each handler the block is left if RIP isn't the address of the next
+ * instruction (branch, fault or restart), or if a compiled block was
+ * invalidated by a memory write. A taken jmp to the start of the block
+ * loops without leaving it.
+ *
+ * Hardware interrupts are checked at the start of the block, so on every
+ * iteration of a loop, and after each handler call.
+ *
+ * Host registers while a block runs:
+ *	rbx - &jit.dirty
+ *	r12 - &regs
+ *	r13 - &run
+ *	r14 - guest memory
+ *	r15 - instructions not yet added to run.icount
+ */
+
+struct jit jit;
+
+/* Handler call of an inline instruction whose guard failed. Placed after
+ * the block, so the fast path falls through.
+ */
+struct jit_stub {
+	struct decode d;	/* Instruction */
+	leg_addr_t rip;		/* Guest RIP of the instruction */
+	int rip_dirty;		/* Set if regs.rip is behind rip */
+	uint8_t *from[2];	/* Patch points of the guards */
+	uint8_t *resume;	/* Next instruction */
+};
+
+/* Code emission */
+struct jit_emit {
+	uint8_t *p;		/* Next code byte */
+	uint8_t *exit0;		/* Leave block, interrupts not yet checked */
+	uint8_t *exit1;		/* Leave block, interrupts already checked */
+	uint8_t *head;		/* First instruction of the block */
+	leg_addr_t paddr;	/* Guest address of head */
+	leg_addr_t rip;		/* Guest RIP at this point of the block */
+	int rip_dirty;		/* Set if regs.rip is behind rip */
+	int called;		/* Set if a handler was called since the last interrupt check */
+	leg_addr_t rcmp;	/* RCMP value expected by the guards */
+	leg_addr_t rarth;	/* RARTH value expected by the guards */
+	leg_addr_t rlgic;	/* RLGIC value expected by the guards */
+	struct jit_stub stub[JIT_BLOCK_INSNS];
+	int stubs;		/* Number of stubs */
+};
+
+#define JIT_X86_JB	0x82
+#define JIT_X86_JE	0x84
+#define JIT_X86_JNE	0x85
+#define JIT_X86_JA	0x87
+
+static void _jit_u8(struct jit_emit *e, uint8_t val) {
+	*e->p++ = val;
+}
+
+static void _jit_u32(struct jit_emit *e, uint32_t val) {
+	memcpy(e->p, &val, sizeof(val));
+	e->p += sizeof(val);
+}
+
+static void _jit_u64(struct jit_emit *e, uint64_t val) {
+	memcpy(e->p, &val, sizeof(val));
+	e->p += sizeof(val);
+}
+
+/* Offset of a register from &regs */
+static uint32_t _jit_reg(leg_addr_t regid) {
+	return (uint32_t) ((volatile char *) regs_list[regid / 4] - (volatile char *) &regs);
+}
+
+/* [r12 + disp32] operand for the given register */
+static void _jit_modrm_reg(struct jit_emit *e, uint8_t op, leg_addr_t regid) {
+	_jit_u8(e, 0x84 | (op << 3));
+	_jit_u8(e, 0x24);
+	_jit_u32(e, _jit_reg(regid));
+}
+
+/* mov dword [r12 + reg], imm32 */
+static void _jit_reg_set(struct jit_emit *e, leg_addr_t regid, uint32_t val) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0xC7);
+	_jit_modrm_reg(e, 0, regid);
+	_jit_u32(e, val);
+}
+
+/* mov eax, dword [r12 + reg] */
+static void _jit_reg_load(struct jit_emit *e, leg_addr_t regid) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x8B);
+	_jit_modrm_reg(e, 0, regid);
+}
+
+/* cmp dword [r12 + reg], imm32 */
+static void _jit_reg_cmp(struct jit_emit *e, leg_addr_t regid, uint32_t val) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x81);
+	_jit_modrm_reg(e, 7, regid);
+	_jit_u32(e, val);
+}
+
+/* test byte [r12 + reg], imm8 */
+static void _jit_reg_test(struct jit_emit *e, leg_addr_t regid, uint8_t val) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0xF6);
+	_jit_modrm_reg(e, 0, regid);
+	_jit_u8(e, val);
+}
+
+/* jcc rel32 to a known target */
+static void _jit_jcc(struct jit_emit *e, uint8_t cc, uint8_t *target) {
+	_jit_u8(e, 0x0F);
+	_jit_u8(e, cc);
+	_jit_u32(e, (uint32_t) (target - (e->p + 4)));
+}
+
+/* jcc rel32 to a target set later with _jit_patch(). Returns the patch point. */
+static uint8_t *_jit_jcc_fwd(struct jit_emit *e, uint8_t cc) {
+	_jit_u8(e, 0x0F);
+	_jit_u8(e, cc);
+	_jit_u32(e, 0);
+
+	return e->p;
+}
+
+static void _jit_patch(struct jit_emit *e, uint8_t *from) {
+	uint32_t rel = (uint32_t) (e->p - from);
+
+	memcpy(from - 4, &rel, sizeof(rel));
+}
+
+/* jmp rel32 */
+static void _jit_jmp(struct jit_emit *e, uint8_t *target) {
+	_jit_u8(e, 0xE9);
+	_jit_u32(e, (uint32_t) (target - (e->p + 4)));
+}
+
+/* mov rax, imm64; call rax */
+static void _jit_call(struct jit_emit *e, const void *fn) {
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0xB8);
+	_jit_u64(e, (uint64_t) (uintptr_t) fn);
+	_jit_u8(e, 0xFF);
+	_jit_u8(e, 0xD0);
+}
+
+/* Bring regs.rip up to date before it may be observed */
+static void _jit_rip_sync(struct jit_emit *e) {
+	if (!e->rip_dirty)
+		return;
+
+	_jit_reg_set(e, REG_RIP, e->rip);
+
+	e->rip_dirty = 0;
+}
+
+static void _jit_prologue(struct jit_emit *e) {
+	/* push rbx; push r12; push r13; push r14; push r15 */
+	_jit_u8(e, 0x53);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x54);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x55);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x56);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x57);
+
+	/* mov rbx, &jit.dirty */
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0xBB);
+	_jit_u64(e, (uint64_t) (uintptr_t) &jit.dirty);
+
+	/* mov r12, &regs */
+	_jit_u8(e, 0x49);
+	_jit_u8(e, 0xBC);
+	_jit_u64(e, (uint64_t) (uintptr_t) &regs);
+
+	/* mov r13, &run */
+	_jit_u8(e, 0x49);
+	_jit_u8(e, 0xBD);
+	_jit_u64(e, (uint64_t) (uintptr_t) &run);
+
+	/* mov rax, &mm; mov r14, [rax] */
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0xB8);
+	_jit_u64(e, (uint64_t) (uintptr_t) &mm);
+	_jit_u8(e, 0x4C);
+	_jit_u8(e, 0x8B);
+	_jit_u8(e, 0x30);
+
+	/* xor r15d, r15d */
+	_jit_u8(e, 0x45);
+	_jit_u8(e, 0x31);
+	_jit_u8(e, 0xFF);
+}
+
+/* Add the instructions counted on r15 to run.icount */
+static void _jit_icount_flush(struct jit_emit *e) {
+	/* add qword [r13 + icount], r15 */
+	_jit_u8(e, 0x4D);
+	_jit_u8(e, 0x01);
+	_jit_u8(e, 0xBD);
+	_jit_u32(e, offsetof(struct run, icount));
+
+	/* xor r15d, r15d */
+	_jit_u8(e, 0x45);
+	_jit_u8(e, 0x31);
+	_jit_u8(e, 0xFF);
+}
+
+static void _jit_epilogue(struct jit_emit *e, int checked) {
+	_jit_icount_flush(e);
+
+	if (checked) {
+		/* mov eax, 1 */
+		_jit_u8(e, 0xB8);
+		_jit_u32(e, 1);
+	} else {
+		/* xor eax, eax */
+		_jit_u8(e, 0x31);
+		_jit_u8(e, 0xC0);
+	}
+
+	/* pop r15; pop r14; pop r13; pop r12; pop rbx; ret */
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x5F);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x5E);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x5D);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x5C);
+	_jit_u8(e, 0x5B);
+	_jit_u8(e, 0xC3);
+}
+
+/* Leave the block if a compiled block was invalidated: cmp byte [rbx], 0 */
+static void _jit_dirty_check(struct jit_emit *e, uint8_t *exit) {
+	_jit_u8(e, 0x80);
+	_jit_u8(e, 0x3B);
+	_jit_u8(e, 0x00);
+	_jit_jcc(e, JIT_X86_JNE, exit);
+}
+
+/* Check for hardware interrupts before the next instruction, or before
+ * jumping to next if set.
+ */
+static void _jit_interrupt_check(struct jit_emit *e, int mode, uint8_t *next) {
+	uint8_t *skip = NULL;
+	uint32_t rst_mode = (mode & INSTRUCTION_MODE_LOWPRIV) ? REG_RST_BIT_LOWPRIV : 0;
+
+	_jit_reg_test(e, REG_RST, REG_RST_BIT_INTR);
+
+	if (next)
+		_jit_jcc(e, JIT_X86_JE, next);
+	else
+		skip = _jit_jcc_fwd(e, JIT_X86_JE);
+
+	/* regs.rip is only stored here, the fast path keeps it deferred */
+	if (e->rip_dirty)
+		_jit_reg_set(e, REG_RIP, e->rip);
+
+	_jit_icount_flush(e);
+	_jit_call(e, &interrupt_hw_check);
+
+	/* An interrupt was taken */
+	_jit_reg_cmp(e, REG_RIP, e->rip);
+	_jit_jcc(e, JIT_X86_JNE, e->exit1);
+
+	/* The execution mode changed (context switch) */
+	_jit_reg_load(e, REG_RST);
+	_jit_u8(e, 0x25); /* and eax, imm32 */
+	_jit_u32(e, REG_RST_BIT_PAGING | REG_RST_BIT_LOWPRIV);
+	_jit_u8(e, 0x3D); /* cmp eax, imm32 */
+	_jit_u32(e, rst_mode);
+	_jit_jcc(e, JIT_X86_JNE, e->exit1);
+
+	_jit_dirty_check(e, e->exit1);
+
+	if (next)
+		_jit_jmp(e, next);
+	else
+		_jit_patch(e, skip);
+
+	e->called = 0;
+}
+
+/* Instructions that may store to memory */
+static int _jit_insn_writes(const struct decode *d) {
+	switch (d->id) {
+		case 0x01: /* cpvr */
+		case 0x02: /* cpvl */
+		case 0x03: /* cpr */
+			return d->oper2_type == OPERAND_TYPE_LIT;
+		case 0x04: /* cprr */
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Instructions that end a block */
+static int _jit_insn_ends(const struct decode *d) {
+	switch (d->id) {
+		case 0x06: /* jmp */
+		case 0x07: /* call */
+		case 0x08: /* ret */
+		case 0x0B: /* intr */
+		case 0x0E: /* ltsk */
+			return 1;
+	}
+
+	/* A new RST value may change the execution mode */
+	return (d->oper2_type == OPERAND_TYPE_REG) && (d->oper2 == REG_RST);
+}
+
+/* Call the handler of the interpreter. Returns 1 if the block ends. */
+static int _jit_insn_call(struct jit_emit *e, const struct decode *d, int mode) {
+	leg_addr_t next = e->rip + d->size;
+
+	/* mov dword [r13 + opcode], imm32 */
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0xC7);
+	_jit_u8(e, 0x85);
+	_jit_u32(e, offsetof(struct run, opcode));
+	_jit_u32(e, d->opcode);
+
+	_jit_rip_sync(e);
+
+	/* Handler arguments: edi, esi, edx, ecx, r8d */
+	_jit_u8(e, 0xBF);
+	_jit_u32(e, d->oper1);
+	_jit_u8(e, 0xBE);
+	_jit_u32(e, d->oper2);
+	_jit_u8(e, 0xBA);
+	_jit_u32(e, d->size);
+	_jit_u8(e, 0xB9);
+	_jit_u32(e, d->oper1_type);
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0xB8);
+	_jit_u32(e, d->oper2_type);
+
+	/* The handler may stop the VM */
+	_jit_icount_flush(e);
+	_jit_call(e, instruction_dispatch[mode][d->variant]);
+
+	e->rip = next;
+
+	if (_jit_insn_ends(d)) {
+		_jit_jmp(e, e->exit0);
+		return 1;
+	}
+
+	/* Leave on branches, faults and restarted instructions */
+	_jit_reg_cmp(e, REG_RIP, next);
+	_jit_jcc(e, JIT_X86_JNE, e->exit0);
+
+	/* Leave if a compiled block was overwritten */
+	if (_jit_insn_writes(d))
+		_jit_dirty_check(e, e->exit0);
+
+	return 0;
+}
+
+static void _jit_stub_emit(struct jit_emit *e, struct jit_stub *s, int mode) {
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (s->from[i])
+			_jit_patch(e, s->from[i]);
+	}
+
+	e->rip = s->rip;
+	e->rip_dirty = s->rip_dirty;
+
+	_jit_insn_call(e, &s->d, mode);
+	_jit_jmp(e, s->resume);
+}
+
+#ifndef DEBUG
+/* Add a stub for the instruction at the current point */
+static struct jit_stub *_jit_stub(struct jit_emit *e, const struct decode *d) {
+	struct jit_stub *s = &e->stub[e->stubs++];
+
+	s->d = *d;
+	s->rip = e->rip;
+	s->rip_dirty = e->rip_dirty;
+	s->from[0] = NULL;
+	s->from[1] = NULL;
+
+	return s;
+}
+
+/* mov dword [r12 + reg], eax */
+static void _jit_reg_store(struct jit_emit *e, leg_addr_t regid) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, 0x89);
+	_jit_modrm_reg(e, 0, regid);
+}
+
+/* Operation between a host register (eax to edi) and [r12 + reg] */
+static void _jit_reg_op(struct jit_emit *e, uint8_t opcode, uint8_t hreg, leg_addr_t regid) {
+	_jit_u8(e, 0x41);
+	_jit_u8(e, opcode);
+	_jit_modrm_reg(e, hreg, regid);
+}
+
+/* setcc opcode for a RCMP comparison mode, 0 if invalid. Operands are
+ * unsigned.
+ */
+static uint8_t _jit_cmp_setcc(uint32_t rcmp) {
+	switch (rcmp) {
+		case REG_RCMP_BIT_NE: return 0x95; /* setne */
+		case REG_RCMP_BIT_GT: return 0x97; /* seta */
+		case REG_RCMP_BIT_LT: return 0x92; /* setb */
+		case REG_RCMP_BIT_EQ: return 0x94; /* sete */
+		case REG_RCMP_BITS_GE: return 0x93; /* setae */
+		case REG_RCMP_BITS_LE: return 0x96; /* setbe */
+	}
+
+	return 0;
+}
+
+/* Registers that can't be accessed inline. RIP is deferred and RARTH may
+ * have pending ALU flags.
+ */
+static int _jit_reg_inline(leg_addr_t regid) {
+	return (regid != REG_RIP) && (regid != REG_RST) && (regid != REG_RARTH);
+}
+
+/* Registers that arth and lgic can use inline. RFP registers select the
+ * floating point kernels.
+ */
+static int _jit_reg_alu(leg_addr_t regid) {
+	return _jit_reg_inline(regid) && ((regid < REG_RFP1) || (regid > REG_RFP4));
+}
+
+/* Call the handler unless the memory reference on the host register is in
+ * zone normal and the whole word is in RAM. The handler raises the faults.
+ */
+static void _jit_mm_check(struct jit_emit *e, uint8_t hreg, struct jit_stub *s) {
+	/* cmp reg, MM_ZONE_NORMAL */
+	_jit_u8(e, 0x81);
+	_jit_u8(e, 0xF8 | hreg);
+	_jit_u32(e, MM_ZONE_NORMAL);
+	s->from[0] = _jit_jcc_fwd(e, JIT_X86_JB);
+
+	/* cmp reg, ram - word */
+	_jit_u8(e, 0x81);
+	_jit_u8(e, 0xF8 | hreg);
+	_jit_u32(e, config.vm.ram - (ARCH_ADDR_BITS >> 3));
+	s->from[1] = _jit_jcc_fwd(e, JIT_X86_JA);
+}
+
+/* Test the decode map bits of the code blocks a word store at edi may
+ * overlap, as decode_write() does. Zone normal starts past the largest
+ * fused group, so these are the block of edi - (DECODE_SPAN_MAX - 1) and
+ * the next one. Clears ZF if either holds cached code.
+ */
+static void _jit_map_test(struct jit_emit *e) {
+	/* mov rdx, &dcache.map; mov rdx, [rdx] */
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0xBA);
+	_jit_u64(e, (uint64_t) (uintptr_t) &dcache.map);
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0x8B);
+	_jit_u8(e, 0x12);
+
+	/* lea ecx, [rdi - (DECODE_SPAN_MAX - 1)]; shr ecx, DECODE_BLOCK_SHIFT */
+	_jit_u8(e, 0x8D);
+	_jit_u8(e, 0x4F);
+	_jit_u8(e, (uint8_t) -(DECODE_SPAN_MAX - 1));
+	_jit_u8(e, 0xC1);
+	_jit_u8(e, 0xE9);
+	_jit_u8(e, DECODE_BLOCK_SHIFT);
+
+	/* mov esi, ecx; shr esi, 3; movzx esi, word [rdx + rsi] */
+	_jit_u8(e, 0x89);
+	_jit_u8(e, 0xCE);
+	_jit_u8(e, 0xC1);
+	_jit_u8(e, 0xEE);
+	_jit_u8(e, 0x03);
+	_jit_u8(e, 0x0F);
+	_jit_u8(e, 0xB7);
+	_jit_u8(e, 0x34);
+	_jit_u8(e, 0x32);
+
+	/* and ecx, 7; shr esi, cl; test esi, 3 */
+	_jit_u8(e, 0x83);
+	_jit_u8(e, 0xE1);
+	_jit_u8(e, 0x07);
+	_jit_u8(e, 0xD3);
+	_jit_u8(e, 0xEE);
+	_jit_u8(e, 0xF7);
+	_jit_u8(e, 0xC6);
+	_jit_u32(e, 3);
+}
+
+/* Record the pending operation on alu_flags, pointed by rsi */
+static void _jit_flags_op(struct jit_emit *e, uint8_t op, uint8_t size) {
+	/* mov word [rsi + op], size:op */
+	if (offsetof(struct alu_flags, size) == (offsetof(struct alu_flags, op) + 1)) {
+		_jit_u8(e, 0x66);
+		_jit_u8(e, 0xC7);
+		_jit_u8(e, 0x86);
+		_jit_u32(e, offsetof(struct alu_flags, op));
+		_jit_u8(e, op);
+		_jit_u8(e, size);
+
+		return;
+	}
+
+	/* mov byte [rsi + op], op; mov byte [rsi + size], size */
+	_jit_u8(e, 0xC6);
+	_jit_u8(e, 0x86);
+	_jit_u32(e, offsetof(struct alu_flags, op));
+	_jit_u8(e, op);
+	_jit_u8(e, 0xC6);
+	_jit_u8(e, 0x86);
+	_jit_u32(e, offsetof(struct alu_flags, size));
+	_jit_u8(e, size);
+}
+
+/* mov qword [rsi + offset], 0 */
+static void _jit_flags_zero(struct jit_emit *e, uint32_t offset) {
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0xC7);
+	_jit_u8(e, 0x86);
+	_jit_u32(e, offset);
+	_jit_u32(e, 0);
+}
+
+/* movsxd rdi, reg; mov [rsi + offset], rdi */
+static void _jit_flags_oper(struct jit_emit *e, uint32_t offset, uint8_t hreg) {
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0x63);
+	_jit_u8(e, 0xF8 | hreg);
+	_jit_u8(e, 0x48);
+	_jit_u8(e, 0x89);
+	_jit_u8(e, 0xBE);
+	_jit_u32(e, offset);
+}
+
+/* Emit the instruction inline. Only privilege level 0 handlers without
+ * paging are simple enough. Returns 0 if the handler must be called.
+ */
+static int _jit_insn_inline(struct jit_emit *e, const struct decode *d, int mode, int *end) {
+	leg_addr_t next = e->rip + d->size;
+	struct jit_stub *s;
+	uint8_t *skip, *stored, setcc, opcode, opflags;
+	uint32_t rcmp, rarth;
+
+	if (mode)
+		return 0;
+
+	switch (d->id) {
+		case 0x01: /* cpvr */
+			if ((d->variant != INSTRUCTION_cpvr_rr) || !_jit_reg_inline(d->oper1) || !_jit_reg_inline(d->oper2))
+				return 0;
+
+			_jit_reg_load(e, d->oper1);
+			_jit_reg_store(e, d->oper2);
+
+			break;
+		case 0x02: /* cpvl */
+			if (d->variant != INSTRUCTION_cpvl_lr)
+				return 0;
+
+			/* Later guards expect the values loaded by the block */
+			switch (d->oper2) {
+				case REG_RCMP: e->rcmp = d->oper1; break;
+				case REG_RARTH: e->rarth = d->oper1; break;
+				case REG_RLGIC: e->rlgic = d->oper1; break;
+			}
+
+			if (!_jit_reg_inline(d->oper2))
+				return 0;
+
+			_jit_reg_set(e, d->oper2, d->oper1);
+
+			break;
+		case 0x03: /* cpr */
+			if ((d->variant != INSTRUCTION_cpr_rr) || !_jit_reg_inline(d->oper1) || !_jit_reg_inline(d->oper2))
+				return 0;
+
+			/* mov eax, [r12 + oper1] */
+			s = _jit_stub(e, d);
+			_jit_reg_load(e, d->oper1);
+			_jit_mm_check(e, 0, s);
+
+			/* mov eax, [r14 + rax]; bswap eax */
+			_jit_u8(e, 0x41);
+			_jit_u8(e, 0x8B);
+			_jit_u8(e, 0x04);
+			_jit_u8(e, 0x06);
+			_jit_u8(e, 0x0F);
+			_jit_u8(e, 0xC8);
+
+			_jit_reg_store(e, d->oper2);
+
+			s->resume = e->p;
+
+			break;
+		case 0x04: /* cprr */
+			if ((d->variant != INSTRUCTION_cprr_rr) || !_jit_reg_inline(d->oper1) || !_jit_reg_inline(d->oper2))
+				return 0;
+
+			/* Watchpoint hits report this instruction */
+			if (config.vm.watch_count)
+				_jit_rip_sync(e);
+
+			/* mov edi, [r12 + oper2] */
+			s = _jit_stub(e, d);
+			_jit_reg_op(e, 0x8B, 7, d->oper2);
+			_jit_mm_check(e, 7, s);
+
+			/* mov eax, [r12 + oper1]; bswap eax; mov [r14 + rdi], eax */
+			_jit_reg_load(e, d->oper1);
+			_jit_u8(e, 0x0F);
+			_jit_u8(e, 0xC8);
+			_jit_u8(e, 0x41);
+			_jit_u8(e, 0x89);
+			_jit_u8(e, 0x04);
+			_jit_u8(e, 0x3E);
+
+			_jit_map_test(e);
+			stored = _jit_jcc_fwd(e, JIT_X86_JE);
+
+			/* Drop any cached decode of overwritten code:
+			 * mov esi, word
+			 */
+			_jit_u8(e, 0xBE);
+			_jit_u32(e, ARCH_ADDR_BITS >> 3);
+			_jit_call(e, &decode_invalidate);
+
+			/* Leave if a compiled block was overwritten */
+			_jit_reg_set(e, REG_RIP, next);
+			_jit_dirty_check(e, e->exit0);
+
+			_jit_patch(e, stored);
+
+			s->resume = e->p;
+
+			break;
+		case 0x05: /* cmp */
+			if ((d->variant != INSTRUCTION_cmp_rr) || !_jit_reg_inline(d->oper1) || !_jit_reg_inline(d->oper2))
+				return 0;
+
+			/* Comparisons use the expected RCMP mode */
+			rcmp = e->rcmp & (REG_RCMP_BIT_NE | REG_RCMP_BIT_GT | REG_RCMP_BIT_LT | REG_RCMP_BIT_EQ);
+
+			if (!(setcc = _jit_cmp_setcc(rcmp)))
+				return 0;
+
+			/* Guard: fall back to the handler if RCMP mode changed.
+			 * mov edx, [r12 + rcmp]; mov eax, edx; and eax, mask;
+			 * cmp eax, rcmp
+			 */
+			s = _jit_stub(e, d);
+			_jit_reg_op(e, 0x8B, 2, REG_RCMP);
+			_jit_u8(e, 0x89);
+			_jit_u8(e, 0xD0);
+			_jit_u8(e, 0x25);
+			_jit_u32(e, REG_RCMP_BIT_NE | REG_RCMP_BIT_GT | REG_RCMP_BIT_LT | REG_RCMP_BIT_EQ);
+			_jit_u8(e, 0x3D);
+			_jit_u32(e, rcmp);
+			s->from[0] = _jit_jcc_fwd(e, JIT_X86_JNE);
+
+			/* mov eax, [r12 + oper1]; cmp eax, [r12 + oper2] */
+			_jit_reg_load(e, d->oper1);
+			_jit_u8(e, 0x41);
+			_jit_u8(e, 0x3B);
+			_jit_modrm_reg(e, 0, d->oper2);
+
+			/* setcc cl; movzx ecx, cl */
+			_jit_u8(e, 0x0F);
+			_jit_u8(e, setcc);
+			_jit_u8(e, 0xC1);
+			_jit_u8(e, 0x0F);
+			_jit_u8(e, 0xB6);
+			_jit_u8(e, 0xC9);
+
+			/* Replace RCMP result bit: and edx, ~1; or edx, ecx */
+			_jit_u8(e, 0x83);
+			_jit_u8(e, 0xE2);
+			_jit_u8(e, (uint8_t) ~REG_RCMP_BIT_RESULT);
+			_jit_u8(e, 0x09);
+			_jit_u8(e, 0xCA);
+			_jit_reg_op(e, 0x89, 2, REG_RCMP);
+
+			s->resume = e->p;
+
+			break;
+		case 0x06: /* jmp */
+			/* If RCMP result bit is 1, jump */
+			_jit_reg_test(e, REG_RCMP, REG_RCMP_BIT_RESULT);
+			skip = _jit_jcc_fwd(e, JIT_X86_JE);
+
+			if (d->oper1 == e->paddr) {
+				/* Loop without leaving the block */
+				e->rip = d->oper1;
+				e->rip_dirty = 1;
+				_jit_interrupt_check(e, mode, e->head);
+			} else {
+				_jit_reg_set(e, REG_RIP, d->oper1);
+				_jit_jmp(e, e->exit0);
+			}
+
+			_jit_patch(e, skip);
+			_jit_reg_set(e, REG_RIP, next);
+			_jit_jmp(e, e->exit0);
+
+			*end = 1;
+			e->rip = next;
+			e->rip_dirty = 0;
+
+			return 1;
+		case 0x09: /* arth */
+			if ((d->variant != INSTRUCTION_arth_rr) || !_jit_reg_alu(d->oper1) || !_jit_reg_alu(d->oper2))
+				return 0;
+
+			/* Only add and sub of whole registers, without extended
+			 * operands, with the expected RARTH value
+			 */
+			rarth = e->rarth & ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF);
+
+			switch (rarth & ~REG_ARTH_BIT_SIGNED) {
+				case REG_ARTH_BIT_ADD: opcode = 0x01; break;
+				case REG_ARTH_BIT_SUB: opcode = 0x29; break;
+				default: return 0;
+			}
+
+			/* Guard: mov eax, [r12 + rarth]; and eax, ~(OF | UF);
+			 * cmp eax, rarth. Flags of previous operations are
+			 * dropped.
+			 */
+			s = _jit_stub(e, d);
+			_jit_reg_load(e, REG_RARTH);
+			_jit_u8(e, 0x25);
+			_jit_u32(e, ~(REG_ARTH_BIT_OF | REG_ARTH_BIT_UF));
+			_jit_u8(e, 0x3D);
+			_jit_u32(e, rarth);
+			s->from[0] = _jit_jcc_fwd(e, JIT_X86_JNE);
+
+			/* mov ecx, [r12 + oper1]; mov edx, [r12 + oper2];
+			 * mov rsi, &alu_flags
+			 */
+			_jit_reg_op(e, 0x8B, 1, d->oper1);
+			_jit_reg_op(e, 0x8B, 2, d->oper2);
+			_jit_u8(e, 0x48);
+			_jit_u8(e, 0xBE);
+			_jit_u64(e, (uint64_t) (uintptr_t) &alu_flags);
+
+			/* Signed operations leave OF and UF to be evaluated when
+			 * RARTH is read. Unsigned ones set OF (add) or UF (sub)
+			 * from the carry, and then leave the signed operation on
+			 * zeroed 8-bit operands pending, as the kernels do.
+			 */
+			opflags = (rarth & REG_ARTH_BIT_ADD) ? ALU_FLAGS_ADD_SIGNED : ALU_FLAGS_SUB_SIGNED;
+
+			if (rarth & REG_ARTH_BIT_SIGNED) {
+				_jit_flags_op(e, opflags, sizeof(leg_long_t));
+				_jit_flags_oper(e, offsetof(struct alu_flags, from), 1);
+				_jit_flags_oper(e, offsetof(struct alu_flags, to), 2);
+
+				/* add/sub edx, ecx */
+				_jit_u8(e, opcode);
+				_jit_u8(e, 0xCA);
+			} else {
+				_jit_flags_op(e, opflags, sizeof(leg_char_t));
+				_jit_flags_zero(e, offsetof(struct alu_flags, from));
+				_jit_flags_zero(e, offsetof(struct alu_flags, to));
+
+				/* add/sub edx, ecx; sbb ecx, ecx; and ecx, flag;
+				 * or eax, ecx
+				 */
+				_jit_u8(e, opcode);
+				_jit_u8(e, 0xCA);
+				_jit_u8(e, 0x19);
+				_jit_u8(e, 0xC9);
+				_jit_u8(e, 0x81);
+				_jit_u8(e, 0xE1);
+				_jit_u32(e, (rarth & REG_ARTH_BIT_ADD) ? REG_ARTH_BIT_OF : REG_ARTH_BIT_UF);
+				_jit_u8(e, 0x09);
+				_jit_u8(e, 0xC8);
+			}
+
+			/* mov [r12 + oper2], edx */
+			_jit_reg_op(e, 0x89, 2, d->oper2);
+			_jit_reg_store(e, REG_RARTH);
+
+			s->resume = e->p;
+
+			break;
+		case 0x0A: /* lgic */
+			if ((d->variant != INSTRUCTION_lgic_rr) || !_jit_reg_alu(d->oper1) || !_jit_reg_alu(d->oper2))
+				return 0;
+
+			/* Only xor, and, or of whole registers, with the expected
+			 * RLGIC value
+			 */
+			switch (e->rlgic) {
+				case REG_RLGIC_BIT_XOR: opcode = 0x31; break;
+				case REG_RLGIC_BIT_AND: opcode = 0x21; break;
+				case REG_RLGIC_BIT_OR: opcode = 0x09; break;
+				default: return 0;
+			}
+
+			/* Guard: fall back to the handler if RLGIC changed */
+			s = _jit_stub(e, d);
+			_jit_reg_cmp(e, REG_RLGIC, e->rlgic);
+			s->from[0] = _jit_jcc_fwd(e, JIT_X86_JNE);
+
+			/* mov eax, [r12 + oper1]; op [r12 + oper2], eax */
+			_jit_reg_load(e, d->oper1);
+			_jit_reg_op(e, opcode, 0, d->oper2);
+
+			s->resume = e->p;
+
+			break;
+		case 0x0D: /* nop */
+			break;
+		default:
+			return 0;
+	}
+
+	/* Update RIP to point to the next instruction, when needed */
+	e->rip = next;
+	e->rip_dirty = 1;
+
+	return 1;
+}
+#endif
+
+/* Emit one guest instruction. Returns 1 if the block ends with it. */
+static int _jit_insn(struct jit_emit *e, const struct decode *d, int mode) {
+#ifndef DEBUG
+	int end = 0;
+#endif
+
+	/* inc r15 */
+	_jit_u8(e, 0x49);
+	_jit_u8(e, 0xFF);
+	_jit_u8(e, 0xC7);
+
+#ifndef DEBUG
+	if (_jit_insn_inline(e, d, mode, &end))
+		return end;
+#endif
+
+	/* Interrupts are checked before the next instruction */
+	e->called = 1;
+
+	return _jit_insn_call(e, d, mode);
+}
+
+/* The code buffer is only writable while a block is compiled */
+static int _jit_protect(int prot) {
+	return mprotect(jit.code, JIT_CODE_SIZE, prot);
+}
+
+static int _jit_compile(struct jit_block *b) {
+	struct jit_emit e;
+	struct decode d, *dl;
+	leg_addr_t paddr = b->paddr;
+	int mode = b->mode, n, i, end = 0;
+
+	/* Loop idioms run faster on the interpreter */
+	if ((dl = decode_lookup(paddr)) && (dl->fused >= INSTRUCTION_FUSE_LOOP_COPY))
+		return -1;
+
+	/* Start over when the code buffer is full */
+	if ((jit.used + (JIT_BLOCK_INSNS + 1) * JIT_INSN_CODE_MAX) > JIT_CODE_SIZE) {
+		jit_flush();
+
+		b->paddr = paddr;
+		b->mode = mode;
+	}
+
+	if (_jit_protect(PROT_READ | PROT_WRITE) < 0)
+		return -1;
+
+	e.p = jit.code + jit.used;
+
+	/* Block exits are placed before the entry point */
+	e.exit0 = e.p;
+	_jit_epilogue(&e, 0);
+	e.exit1 = e.p;
+	_jit_epilogue(&e, 1);
+
+	b->code = (int (*) (void)) e.p;
+
+	_jit_prologue(&e);
+
+	/* regs.rip is only up to date on entry, not when looping back */
+	e.head = e.p;
+	e.paddr = paddr;
+	e.rip = paddr;
+	e.rip_dirty = 1;
+	e.called = 0;
+	e.stubs = 0;
+
+	/* Until the block loads its own */
+	e.rcmp = regs.rcmp;
+	e.rarth = regs.rarth;
+	e.rlgic = regs.rlgic;
+
+	for (n = 0; (n < JIT_BLOCK_INSNS) && !end; n++) {
+		/* Leave undecodable instructions to the interpreter */
+		if (decode_peek(e.rip, &d) < 0)
+			break;
+
+		if (e.called)
+			_jit_interrupt_check(&e, mode, NULL);
+
+		end = _jit_insn(&e, &d, mode);
+	}
+
+	if (!end && n) {
+		_jit_rip_sync(&e);
+		_jit_jmp(&e, e.exit0);
+	}
+
+	for (i = 0; i < e.stubs; i++)
+		_jit_stub_emit(&e, &e.stub[i], mode);
+
+	/* Blocks already compiled run from the buffer, so it must be made
+	 * executable again even if this one is dropped
+	 */
+	if (_jit_protect(PROT_READ | PROT_EXEC) < 0) {
+		jit_flush();
+		return -1;
+	}
+
+	if (!n) {
+		b->code = NULL;
+		return -1;
+	}
+
+	b->span = e.rip - paddr;
+
+	jit.used = e.p - jit.code;
+	jit.blocks++;
+
+	/* Writes to the block must reach jit_invalidate() */
+	decode_track(paddr, b->span);
+
+	return 0;
+}
+
+struct jit_block *jit_lookup(leg_addr_t paddr, int mode) {
+	struct jit_block *b = &jit.block[(paddr >> 2) & (JIT_CACHE_SIZE - 1)];
+
+	if ((b->paddr != paddr) || (b->mode != mode)) {
+		if (b->code)
+			jit.blocks--;
+
+		b->paddr = paddr;
+		b->mode = mode;
+		b->span = 0;
+		b->hits = 0;
+		b->code = NULL;
+	}
+
+	if (b->code)
+		return b;
+
+	/* Compile hot code only */
+	if (++b->hits < JIT_THRESHOLD)
+		return NULL;
+
+	b->hits = 0;
+
+	if (_jit_compile(b) < 0)
+		return NULL;
+
+	return b;
+}
+
+/* Mark paddr as hot, so the block starting there is compiled the first time
+ * it runs in the given mode.
+ */
+void jit_hint(leg_addr_t paddr, int mode) {
+	struct jit_block *b = &jit.block[(paddr >> 2) & (JIT_CACHE_SIZE - 1)];
+
+	/* Keep compiled blocks */
+	if (b->code)
+		return;
+
+	b->paddr = paddr;
+	b->mode = mode;
+	b->span = 0;
+	b->hits = JIT_THRESHOLD - 1;
+}
+
+void jit_invalidate(leg_addr_t addr, leg_addr_t size) {
+	struct jit_block *b;
+
+	if (!jit.blocks)
+		return;
+
+	for (b = jit.block; b < &jit.block[JIT_CACHE_SIZE]; b++) {
+		if (b->code && (b->paddr < ((uint64_t) addr + size)) && (((uint64_t) b->paddr + b->span) > addr)) {
+			b->code = NULL;
+			b->span = 0;
+
+			jit.blocks--;
+
+			/* Running blocks must stop before reaching stale code */
+			jit.dirty = 1;
+		}
+	}
+}
+
+void jit_flush(void) {
+	memset(jit.block, 0, sizeof(jit.block));
+
+	jit.used = 0;
+	jit.blocks = 0;
+	jit.dirty = 1;
+}
+
+int jit_init(void) {
+	void *code;
+
+	/* Never writable and executable at once, see _jit_compile() */
+	if ((code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+		return -1;
+
+	jit.code = code;
+
+	/* Blocks are empty, but may already carry hints */
+	jit.used = 0;
+	jit.blocks = 0;
+	jit.dirty = 1;
+
+	return 0;
+}
+
+void jit_destroy(void) {
+	if (jit.code)
+		munmap(jit.code, JIT_CODE_SIZE);
+
+	jit.code = NULL;
+}
+
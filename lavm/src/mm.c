@@ -15,43 +15,883 @@
 
 */
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "archdefs.h"
 #include "config.h"
 #include "mm.h"
 #include "fault.h"
+#include "register.h"
+#include "sighandler.h"
+#include "aot.h"
 
 volatile void *mm;
+struct mm_guard mm_guard;
+struct mm_dirty mm_dirty;
+struct mm_share mm_share;
+struct mm_balloon mm_balloon;
+
+static void *_mm_region;	/* Mapping holding RAM */
+static size_t _mm_region_size;
+
+/* Storage window */
+struct mm_window {
+	leg_addr_t addr;
+	size_t size;		/* 0 if unused */
+	int fd;			/* Storage file mapped */
+	uint64_t offset;	/* Offset of the mapping in fd */
+};
+
+static struct mm_window _mm_window[MM_WINDOW_MAX];
+
+/* RAM written by host I/O, kept writable until the I/O ends */
+struct mm_watch_io {
+	leg_addr_t addr;
+	size_t size;		/* 0 if unused */
+};
 
-int mm_grant_zone_normal(leg_addr_t addr) {
+static size_t _mm_watch_page;	/* Protection granularity, 0 if nothing is watched */
+static uintptr_t _mm_watch_step[MM_WATCH_STEP_MAX];	/* Pages unprotected for a single store */
+static struct mm_watch_io _mm_watch_io[MM_WATCH_IO_MAX];
+static unsigned int _mm_watch_io_lost;	/* Untracked I/O in progress, suppresses rearming */
+
+/* Host I/O doesn't trap on the guard region, so RAM bounds are checked */
+int mm_grant_zone_normal_io(leg_addr_t addr) {
 	if (addr >= config.vm.ram) {
 		fault_bad_mm(addr);
 		return 0;
 	}
 
-	if (addr < MM_ZONE_NORMAL) {
-		fault_no_priv();
-		return 0;
+	return mm_grant_zone_normal(addr);
+}
+
+/* Called on SIGSEGV. Returns if addr isn't a guest access past RAM. */
+void mm_guard_trap(void *addr) {
+	uintptr_t offset = (uintptr_t) addr - (uintptr_t) mm;
+
+	if (!mm_guard.armed || !pthread_equal(pthread_self(), mm_guard.thread))
+		return;
+
+	if (((uintptr_t) addr < (uintptr_t) mm) || (offset < config.vm.ram) || (offset >= MM_GUARD_SIZE))
+		return;
+
+	mm_guard.addr = (leg_addr_t) offset;
+
+	siglongjmp(mm_guard.env, 1);
+}
+
+static void *_mm_map(void *addr, size_t size, int flags) {
+	addr = mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+
+	return addr == MAP_FAILED ? NULL : addr;
+}
+
+#if MM_GUARD_REGION
+/* Reserve the guard region, aligned for huge pages. Returns the RAM base. */
+static void *_mm_guard_reserve(void) {
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	/* Bytes past RAM in its last host page wouldn't trap. Sizes that
+	 * can't be rounded up within MM_SIZE_MAX are rounded down.
+	 */
+	if (config.vm.ram % page) {
+		printf("Memory rounded: ");
+
+		if ((((uint64_t) config.vm.ram + page - 1) & ~((uint64_t) page - 1)) > MM_SIZE_MAX) {
+			config.vm.ram &= ~(page - 1);
+		} else {
+			config.vm.ram = ((uint64_t) config.vm.ram + page - 1) & ~((uint64_t) page - 1);
+		}
 	}
 
-	return 1;
+	_mm_region_size = MM_GUARD_SIZE + MM_HUGEPAGE_SIZE;
+
+	if ((_mm_region = mmap(NULL, _mm_region_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+		_mm_region = NULL;
+		return NULL;
+	}
+
+	return (void *) (((uintptr_t) _mm_region + MM_HUGEPAGE_SIZE - 1) & ~((uintptr_t) MM_HUGEPAGE_SIZE - 1));
 }
+#endif
 
 int mm_init(void) {
+	void *base = NULL, *addr = NULL;
+	size_t size = config.vm.ram;
+	int flags = 0;
+
 	if (config.vm.ram >= MM_SIZE_MAX) {
 		printf("Memory truncated: ");
 		config.vm.ram = MM_SIZE_MAX;
 	}
 
-	if (!(mm = malloc(config.vm.ram)))
+#if MM_GUARD_REGION
+	if (!(base = _mm_guard_reserve()))
 		return -1;
 
+	/* RAM replaces the start of the reserved region */
+	flags |= MAP_FIXED;
+	size = config.vm.ram;
+#endif
+
+	if (config.vm.mm & MM_OPT_POPULATE)
+		flags |= MAP_POPULATE;
+
+	if (config.vm.mm & MM_OPT_NORESERVE)
+		flags |= MAP_NORESERVE;
+
+	/* Anonymous mappings are zeroed on first touch */
+	if (config.vm.mm & MM_OPT_HUGETLB) {
+		size = ((size_t) config.vm.ram + MM_HUGEPAGE_SIZE - 1) & ~((size_t) MM_HUGEPAGE_SIZE - 1);
+
+		/* Fall back to transparent huge pages if none are reserved, or
+		 * if RAM past the last huge page wouldn't trap.
+		 */
+		if ((MM_GUARD_REGION && (size != config.vm.ram)) || !(addr = _mm_map(base, size, flags | MAP_HUGETLB))) {
+			printf("no huge pages available, using THP: ");
+			config.vm.mm = (config.vm.mm & ~MM_OPT_HUGETLB) | MM_OPT_THP;
+			size = config.vm.ram;
+		}
+	}
+
+	if (!addr) {
+		if (!(addr = _mm_map(base, size, flags)))
+			goto _fail;
+
+		/* Advice only, the host may have THP disabled */
+		if (config.vm.mm & MM_OPT_THP)
+			madvise(addr, size, MADV_HUGEPAGE);
+	}
+
+#ifdef MADV_MERGEABLE
+	/* Identical pages of VMs booting the same images are merged by the
+	 * host, once it scans them. Advice only, the host may have KSM
+	 * disabled.
+	 */
+	if (config.vm.mm & MM_OPT_MERGE)
+		madvise(addr, size, MADV_MERGEABLE);
+#endif
+
+	if (!MM_GUARD_REGION) {
+		_mm_region = addr;
+		_mm_region_size = size;
+	}
+
+	mm = addr;
+
 	return 0;
+
+_fail:
+	if (_mm_region)
+		munmap(_mm_region, _mm_region_size);
+
+	_mm_region = NULL;
+
+	return -1;
 }
 
 void mm_destroy(void) {
-	free((void *) mm);
+	mm_guard.armed = 0;
+
+	free(mm_dirty.bitmap);
+	mm_dirty.bitmap = NULL;
+
+	free(mm_balloon.bitmap);
+	mm_balloon.bitmap = NULL;
+
+	memset(_mm_window, 0, sizeof(_mm_window));
+
+	if (_mm_region)
+		munmap(_mm_region, _mm_region_size);
+
+	_mm_region = NULL;
+}
+
+/* Set the protection of the host pages backing size bytes at addr. The
+ * range is clamped to RAM, so the guard region is never unprotected.
+ */
+static int _mm_watch_protect(leg_addr_t addr, size_t size, int prot) {
+	uintptr_t start, end;
+
+	if (addr >= config.vm.ram)
+		return 0;
+
+	if (((uint64_t) addr + size) > config.vm.ram)
+		size = config.vm.ram - addr;
+
+	start = ((uintptr_t) mm + addr) & ~(_mm_watch_page - 1);
+	end = ((uintptr_t) mm + addr + size + _mm_watch_page - 1) & ~(_mm_watch_page - 1);
+
+	return mprotect((void *) start, end - start, prot);
+}
+
+/* Returns 1 if the host page at start is written by I/O in progress */
+static int _mm_watch_io_page(uintptr_t start) {
+	struct mm_watch_io *io;
+	uintptr_t end = start + _mm_watch_page;
+
+	for (io = _mm_watch_io; io < &_mm_watch_io[MM_WATCH_IO_MAX]; io++) {
+		if (io->size && (start < ((uintptr_t) mm + io->addr + io->size)) && (end > ((uintptr_t) mm + io->addr)))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Write protect all watched RAM again, after wider ranges were unprotected.
+ * Pages still written by I/O, such as ring reads in flight, stay writable.
+ */
+static void _mm_watch_rearm(void) {
+	struct config_watch *w;
+	uintptr_t page, start, end;
+
+	if (!_mm_watch_page || _mm_watch_io_lost)
+		return;
+
+	for (w = config.vm.watch; w < &config.vm.watch[config.vm.watch_count]; w++) {
+		start = ((uintptr_t) mm + w->addr) & ~(_mm_watch_page - 1);
+		end = ((uintptr_t) mm + w->addr + w->size + _mm_watch_page - 1) & ~(_mm_watch_page - 1);
+
+		/* Protect the runs of pages not written by I/O */
+		for (page = start; page < end; page += _mm_watch_page) {
+			if (!_mm_watch_io_page(page))
+				continue;
+
+			if (page > start)
+				mprotect((void *) start, page - start, PROT_READ);
+
+			start = page + _mm_watch_page;
+		}
+
+		if (end > start)
+			mprotect((void *) start, end - start, PROT_READ);
+	}
+}
+
+/* Returns the watchpoint holding offset, or any watchpoint sharing its page */
+static struct config_watch *_mm_watch_lookup(uintptr_t offset, int exact) {
+	struct config_watch *w;
+	uintptr_t page = offset & ~(_mm_watch_page - 1);
+
+	for (w = config.vm.watch; w < &config.vm.watch[config.vm.watch_count]; w++) {
+		if ((offset >= w->addr) && (offset < ((uintptr_t) w->addr + w->size)))
+			return w;
+
+		if (!exact && (page >= (w->addr & ~(_mm_watch_page - 1))) && (page < ((uintptr_t) w->addr + w->size)))
+			return w;
+	}
+
+	return NULL;
+}
+
+/* Append str to the message at *p. Async-signal-safe, unlike stdio. */
+static void _mm_watch_str(char **p, const char *str) {
+	while (*str)
+		*(*p)++ = *str++;
+}
+
+/* Append val as 0x%.8X */
+static void _mm_watch_hex(char **p, uint32_t val) {
+	int i;
+
+	_mm_watch_str(p, "0x");
+
+	for (i = 28; i >= 0; i -= 4)
+		*(*p)++ = "0123456789ABCDEF"[(val >> i) & 0xF];
+}
+
+/* Append val as %u */
+static void _mm_watch_dec(char **p, uint32_t val) {
+	char buf[10];
+	int i = 0;
+
+	do {
+		buf[i++] = '0' + (val % 10);
+	} while (val /= 10);
+
+	while (i)
+		*(*p)++ = buf[--i];
+}
+
+/* Log a hit. Runs from the signal handler, so the message is formatted
+ * by hand and written with write(2).
+ */
+static void _mm_watch_hit(const char *kind, leg_addr_t addr, struct config_watch *w) {
+	char msg[128], *p = msg;
+
+	_mm_watch_str(&p, "Watchpoint: ");
+	_mm_watch_str(&p, kind);
+	_mm_watch_str(&p, " ");
+	_mm_watch_hex(&p, addr);
+	_mm_watch_str(&p, " (");
+	_mm_watch_hex(&p, w->addr);
+	_mm_watch_str(&p, "+");
+	_mm_watch_dec(&p, w->size);
+	_mm_watch_str(&p, ") at RIP ");
+	_mm_watch_hex(&p, regs.rip);
+	_mm_watch_str(&p, w->pause ? ", VM paused (SIGCONT resumes)\n" : "\n");
+
+	if (write(STDERR_FILENO, msg, p - msg) != (p - msg))
+		return;
+
+	if (w->pause)
+		sighandler_pause();
+}
+
+/* Write protect the watched RAM. Returns the number of watchpoints. */
+int mm_watch_init(void) {
+	struct config_watch *w;
+
+	if (!MM_WATCH)
+		return -1;
+
+	/* Huge pages can only be protected as a whole */
+	_mm_watch_page = (config.vm.mm & MM_OPT_HUGETLB) ? MM_HUGEPAGE_SIZE : sysconf(_SC_PAGESIZE);
+
+	for (w = config.vm.watch; w < &config.vm.watch[config.vm.watch_count]; w++) {
+		if (((uint64_t) w->addr + w->size) > config.vm.ram)
+			goto _fail;
+
+		if (_mm_watch_protect(w->addr, w->size, PROT_READ) < 0)
+			goto _fail;
+	}
+
+	return config.vm.watch_count;
+
+_fail:
+	_mm_watch_page = 0;
+
+	return -1;
+}
+
+/* Called on SIGSEGV. Returns 1 if addr is in a watched page, which is then
+ * writable until mm_watch_step() is called.
+ */
+int mm_watch_trap(void *addr) {
+	uintptr_t offset = (uintptr_t) addr - (uintptr_t) mm;
+	struct config_watch *w;
+	int i;
+
+	if (!_mm_watch_page || ((uintptr_t) addr < (uintptr_t) mm) || (offset >= config.vm.ram))
+		return 0;
+
+	if (!(w = _mm_watch_lookup(offset, 0)))
+		return 0;
+
+	/* Unwatched bytes may share a page with watched ones */
+	if ((w = _mm_watch_lookup(offset, 1)))
+		_mm_watch_hit("write to", offset, w);
+
+	for (i = 0; (i < MM_WATCH_STEP_MAX) && _mm_watch_step[i]; i++);
+
+	if (i == MM_WATCH_STEP_MAX)
+		return 0;
+
+	_mm_watch_step[i] = (uintptr_t) addr & ~(_mm_watch_page - 1);
+
+	return !mprotect((void *) _mm_watch_step[i], _mm_watch_page, PROT_READ | PROT_WRITE);
+}
+
+/* Called on SIGTRAP, once the trapped store is done */
+void mm_watch_step(void) {
+	int i;
+
+	for (i = 0; (i < MM_WATCH_STEP_MAX) && _mm_watch_step[i]; i++) {
+		mprotect((void *) _mm_watch_step[i], _mm_watch_page, PROT_READ);
+		_mm_watch_step[i] = 0;
+	}
+}
+
+/* Host I/O doesn't trap on protected pages, it fails. Unprotect the range
+ * while it is written and log the watchpoints it hits.
+ */
+void mm_watch_io_begin(leg_addr_t addr, size_t size) {
+	struct config_watch *w;
+	struct mm_watch_io *io;
+
+	if (!_mm_watch_page)
+		return;
+
+	for (w = config.vm.watch; w < &config.vm.watch[config.vm.watch_count]; w++) {
+		if ((addr < ((uint64_t) w->addr + w->size)) && (((uint64_t) addr + size) > w->addr))
+			_mm_watch_hit("I/O to", addr > w->addr ? addr : w->addr, w);
+	}
+
+	/* Watched RAM is clamped to RAM, and so is the range */
+	if (addr >= config.vm.ram)
+		return;
+
+	if (((uint64_t) addr + size) > config.vm.ram)
+		size = config.vm.ram - addr;
+
+	for (io = _mm_watch_io; (io < &_mm_watch_io[MM_WATCH_IO_MAX]) && io->size; io++);
+
+	if (io == &_mm_watch_io[MM_WATCH_IO_MAX]) {
+		_mm_watch_io_lost++;
+	} else {
+		io->addr = addr;
+		io->size = size;
+	}
+
+	_mm_watch_protect(addr, size, PROT_READ | PROT_WRITE);
+}
+
+/* Called once for each mm_watch_io_begin(), with the same range */
+void mm_watch_io_end(leg_addr_t addr, size_t size) {
+	struct mm_watch_io *io;
+
+	if (!_mm_watch_page || (addr >= config.vm.ram))
+		return;
+
+	if (((uint64_t) addr + size) > config.vm.ram)
+		size = config.vm.ram - addr;
+
+	for (io = _mm_watch_io; io < &_mm_watch_io[MM_WATCH_IO_MAX]; io++) {
+		if (io->size && (io->addr == addr) && (io->size == size))
+			break;
+	}
+
+	if (io < &_mm_watch_io[MM_WATCH_IO_MAX])
+		io->size = 0;
+	else if (_mm_watch_io_lost)
+		_mm_watch_io_lost--;
+
+	_mm_watch_rearm();
+}
+
+static void _mm_dirty_mark(size_t chunk) {
+	mm_dirty.bitmap[chunk / 64] |= 1ULL << (chunk % 64);
+}
+
+/* Write protect RAM and start tracking stores to it, at the granularity
+ * configured with the dirty RAM option. Returns the number of chunks.
+ */
+int mm_dirty_init(void) {
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (!MM_DIRTY)
+		return -1;
+
+	/* Huge pages can only be protected as a whole */
+	if (config.vm.mm & MM_OPT_HUGETLB)
+		page = MM_HUGEPAGE_SIZE;
+
+	if (!(mm_dirty.chunk = config.vm.dirty))
+		mm_dirty.chunk = page;
+
+	/* Chunks are whole host pages and RAM ends on one */
+	if ((mm_dirty.chunk < page) || (mm_dirty.chunk & (mm_dirty.chunk - 1)) || (config.vm.ram % page))
+		return -1;
+
+	mm_dirty.count = ((size_t) config.vm.ram + mm_dirty.chunk - 1) / mm_dirty.chunk;
+
+	if (!(mm_dirty.bitmap = calloc((mm_dirty.count + 63) / 64, sizeof(uint64_t))))
+		return -1;
+
+	if (mprotect((void *) mm, config.vm.ram, PROT_READ) < 0) {
+		free(mm_dirty.bitmap);
+		mm_dirty.bitmap = NULL;
+		return -1;
+	}
+
+	return mm_dirty.count;
+}
+
+static void _mm_dirty_protect(size_t chunk, int prot) {
+	size_t size = mm_dirty.chunk;
+
+	/* The last chunk may be partial */
+	if (((chunk + 1) * mm_dirty.chunk) > config.vm.ram)
+		size = config.vm.ram - chunk * mm_dirty.chunk;
+
+	mprotect((char *) mm + chunk * mm_dirty.chunk, size, prot);
+}
+
+/* Unprotect a chunk once it is dirty, so it only traps once per round */
+static void _mm_dirty_unprotect(size_t chunk) {
+	_mm_dirty_protect(chunk, PROT_READ | PROT_WRITE);
+
+	/* Watched RAM may share the chunk */
+	_mm_watch_rearm();
 }
 
+/* Called on SIGSEGV. Returns 1 if addr was a store to clean RAM, which is
+ * now dirty and writable.
+ */
+int mm_dirty_trap(void *addr) {
+	uintptr_t offset = (uintptr_t) addr - (uintptr_t) mm;
+
+	if (!mm_dirty.bitmap || ((uintptr_t) addr < (uintptr_t) mm) || (offset >= config.vm.ram))
+		return 0;
+
+	_mm_dirty_mark(offset / mm_dirty.chunk);
+	_mm_dirty_unprotect(offset / mm_dirty.chunk);
+
+	/* Stores to watched RAM still trap for the watchpoint */
+	return !(_mm_watch_page && _mm_watch_lookup(offset, 0));
+}
+
+/* Host I/O fails on protected pages instead of trapping */
+void mm_dirty_io(leg_addr_t addr, size_t size) {
+	size_t chunk;
+
+	if (!mm_dirty.bitmap || !size)
+		return;
+
+	/* Chunks past RAM have no bits and back the guard region */
+	for (chunk = addr / mm_dirty.chunk; (chunk <= ((size_t) addr + size - 1) / mm_dirty.chunk) && (chunk < mm_dirty.count); chunk++) {
+		_mm_dirty_mark(chunk);
+		_mm_dirty_unprotect(chunk);
+	}
+}
+
+/* Copy the dirty bitmap to bitmap, unless NULL, and optionally clear it,
+ * protecting the chunks again. Returns the number of dirty chunks.
+ */
+size_t mm_dirty_fetch(uint64_t *bitmap, int clear) {
+	size_t i, dirty = 0;
+
+	if (!mm_dirty.bitmap)
+		return 0;
+
+	if (bitmap)
+		memcpy(bitmap, mm_dirty.bitmap, ((mm_dirty.count + 63) / 64) * sizeof(uint64_t));
+
+	for (i = 0; i < mm_dirty.count; i++) {
+		if (!(mm_dirty.bitmap[i / 64] & (1ULL << (i % 64))))
+			continue;
+
+		dirty++;
+
+		if (clear)
+			_mm_dirty_protect(i, PROT_READ);
+	}
+
+	if (clear)
+		memset(mm_dirty.bitmap, 0, ((mm_dirty.count + 63) / 64) * sizeof(uint64_t));
+
+	return dirty;
+}
+
+void mm_dirty_stats(void) {
+	if (!mm_dirty.bitmap)
+		return;
+
+	printf("Dirty RAM: %zu of %zu chunks of %zu bytes\n", mm_dirty_fetch(NULL, 0), mm_dirty.count, mm_dirty.chunk);
+}
+
+/* Returns 1 if any window overlaps size bytes of RAM at addr */
+static int _mm_window_overlap(uintptr_t addr, size_t size) {
+	struct mm_window *w;
+
+	for (w = _mm_window; w < &_mm_window[MM_WINDOW_MAX]; w++) {
+		if (w->size && (addr < ((uintptr_t) w->addr + w->size)) && ((addr + size) > w->addr))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Open the shared copy of size bytes of RAM at addr, creating it if needed */
+static int _mm_share_open(const char *path, leg_addr_t addr, size_t size) {
+	char tmp_path[PATH_MAX];
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) >= 0)
+		return fd;
+
+	/* Written aside and renamed, so other VMs never map a partial file */
+	if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int) getpid()) >= sizeof(tmp_path))
+		return -1;
+
+	if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+		return -1;
+
+	if ((write(fd, mm_ptr(addr), size) != size) || (rename(tmp_path, path) < 0)) {
+		close(fd);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	close(fd);
+
+	return open(path, O_RDONLY);
+}
+
+/* Replace the whole host pages of an image just read into RAM at addr by a
+ * private mapping of its shared copy. Returns the number of bytes mapped.
+ */
+int mm_share_image(leg_addr_t addr, size_t size) {
+	char path[PATH_MAX];
+	size_t page = sysconf(_SC_PAGESIZE), len;
+	uintptr_t start, end;
+	uint64_t hash;
+	struct stat st;
+	void *img;
+	int fd;
+
+	/* Huge pages can't be partially replaced */
+	if (!config.vm.share || (size < MM_SHARE_MIN_SIZE) || (config.vm.mm & MM_OPT_HUGETLB))
+		return 0;
+
+	start = ((uintptr_t) addr + page - 1) & ~(page - 1);
+	end = ((uintptr_t) addr + size) & ~(page - 1);
+
+	if (end <= start)
+		return 0;
+
+	/* Window pages must keep reaching their storage file */
+	if (_mm_window_overlap(start, end - start))
+		return 0;
+
+	len = end - start;
+	hash = aot_hash(mm_ptr(start), len);
+
+	snprintf(path, sizeof(path) - 1, "%s/%.16llx" MM_SHARE_SUFFIX, config.vm.share, (unsigned long long) hash);
+
+	if ((fd = _mm_share_open(path, start, len)) < 0)
+		return -1;
+
+	if ((fstat(fd, &st) < 0) || (st.st_size != len) || ((img = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return -1;
+	}
+
+	/* Hashes may collide */
+	if (memcmp(img, mm_ptr(start), len) || (mmap(mm_ptr(start), len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+		munmap(img, len);
+		close(fd);
+		return -1;
+	}
+
+	munmap(img, len);
+	close(fd);
+
+	mm_share.mapped += len;
+
+	return len;
+}
+
+void mm_share_stats(void) {
+	unsigned long merged = 0;
+	FILE *fp;
+
+	if (!config.vm.share && !(config.vm.mm & MM_OPT_MERGE))
+		return;
+
+	/* Pages merged by the host, on kernels reporting them */
+	if ((fp = fopen("/proc/self/ksm_merging_pages", "r"))) {
+		if (fscanf(fp, "%lu", &merged) != 1)
+			merged = 0;
+
+		fclose(fp);
+	}
+
+	printf("Shared RAM: %llu bytes merged, %llu bytes mapped from images\n",
+		(unsigned long long) merged * sysconf(_SC_PAGESIZE), (unsigned long long) mm_share.mapped);
+}
+
+/* Round the range of size bytes at addr inward to whole balloon pages */
+static int _mm_balloon_range(leg_addr_t addr, size_t size, size_t *first, size_t *last) {
+	if (!mm_balloon.bitmap) {
+		mm_balloon.page = (config.vm.mm & MM_OPT_HUGETLB) ? MM_HUGEPAGE_SIZE : sysconf(_SC_PAGESIZE);
+
+		if (!(mm_balloon.bitmap = calloc((config.vm.ram / mm_balloon.page + 63) / 64, sizeof(uint64_t))))
+			return -1;
+	}
+
+	*first = ((size_t) addr + mm_balloon.page - 1) / mm_balloon.page;
+	*last = ((size_t) addr + size) / mm_balloon.page;
+
+	return 0;
+}
+
+/* Hand the whole host pages of size bytes at addr back to the host. They are
+ * refilled on the next guest access, so deflating only updates accounting.
+ */
+int mm_balloon_inflate(leg_addr_t addr, size_t size) {
+	size_t first, last, page, len;
+
+	if (_mm_balloon_range(addr, size, &first, &last) < 0)
+		return -1;
+
+	if (last <= first)
+		return 0;
+
+	addr = first * mm_balloon.page;
+	len = (last - first) * mm_balloon.page;
+
+	/* Contents change, as if written by the host */
+	mm_dirty_io(addr, len);
+	mm_watch_io_begin(addr, len);
+
+	if (madvise(mm_ptr(addr), len, MADV_DONTNEED) < 0) {
+		mm_watch_io_end(addr, len);
+		return -1;
+	}
+
+	mm_watch_io_end(addr, len);
+
+	for (page = first; page < last; page++) {
+		if (mm_balloon.bitmap[page / 64] & (1ULL << (page % 64)))
+			continue;
+
+		mm_balloon.bitmap[page / 64] |= 1ULL << (page % 64);
+		mm_balloon.bytes += mm_balloon.page;
+	}
+
+	return 0;
+}
+
+void mm_balloon_deflate(leg_addr_t addr, size_t size) {
+	size_t first, last, page;
+
+	if (!mm_balloon.bitmap || (_mm_balloon_range(addr, size, &first, &last) < 0))
+		return;
+
+	for (page = first; page < last; page++) {
+		if (!(mm_balloon.bitmap[page / 64] & (1ULL << (page % 64))))
+			continue;
+
+		mm_balloon.bitmap[page / 64] &= ~(1ULL << (page % 64));
+		mm_balloon.bytes -= mm_balloon.page;
+	}
+}
+
+void mm_balloon_stats(void) {
+	if (!mm_balloon.bitmap)
+		return;
+
+	printf("Balloon: %llu bytes returned to the host\n", (unsigned long long) mm_balloon.bytes);
+}
+
+/* Returns the window holding the range, or the first unused slot if the
+ * range overlaps no window. Returns NULL otherwise.
+ */
+static struct mm_window *_mm_window_lookup(leg_addr_t addr, size_t size) {
+	struct mm_window *w, *unused = NULL;
+
+	for (w = _mm_window; w < &_mm_window[MM_WINDOW_MAX]; w++) {
+		if (!w->size) {
+			if (!unused)
+				unused = w;
+
+			continue;
+		}
+
+		if ((addr >= w->addr) && (((uint64_t) addr + size) <= ((uint64_t) w->addr + w->size)))
+			return w;
+
+		if ((addr < ((uint64_t) w->addr + w->size)) && (((uint64_t) addr + size) > w->addr))
+			return NULL;
+	}
+
+	return unused;
+}
+
+/* Returns 0 if a window of size bytes of storage at offset can be mapped
+ * over RAM at addr, before anything is done to map it.
+ */
+int mm_window_check(leg_addr_t addr, size_t size, uint64_t offset) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct mm_window *w;
+
+	/* Huge pages can't be partially replaced */
+	if (!size || (addr % page) || (size % page) || (offset % page) || (config.vm.mm & MM_OPT_HUGETLB))
+		return -1;
+
+	if ((((uint64_t) addr + size) > config.vm.ram) || !(w = _mm_window_lookup(addr, size)) || w->size)
+		return -1;
+
+	return 0;
+}
+
+/* Map size bytes of the storage file fd at offset over RAM at addr */
+int mm_window_map(leg_addr_t addr, size_t size, int fd, uint64_t offset) {
+	struct mm_window *w;
+	struct stat st;
+	void *ret;
+
+	if ((mm_window_check(addr, size, offset) < 0) || !(w = _mm_window_lookup(addr, size)))
+		return -1;
+
+	/* Accesses past the end of the file would raise SIGBUS */
+	if ((fstat(fd, &st) < 0) || ((offset + size) > (uint64_t) st.st_size))
+		return -1;
+
+	/* Contents change, as if read from storage */
+	mm_dirty_io(addr, size);
+	mm_watch_io_begin(addr, size);
+
+	ret = mmap(mm_ptr(addr), size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, offset);
+
+	mm_watch_io_end(addr, size);
+
+	if (ret == MAP_FAILED)
+		return -1;
+
+	w->addr = addr;
+	w->size = size;
+	w->fd = fd;
+	w->offset = offset;
+
+	return 0;
+}
+
+/* Replace the window mapped at addr with zeroed RAM */
+int mm_window_unmap(leg_addr_t addr, size_t size) {
+	struct mm_window *w;
+	void *ret;
+
+	if (!(w = _mm_window_lookup(addr, size)) || (w->addr != addr) || (w->size != size))
+		return -1;
+
+	mm_dirty_io(addr, size);
+	mm_watch_io_begin(addr, size);
+
+	ret = _mm_map(mm_ptr(addr), size, MAP_FIXED);
+
+	mm_watch_io_end(addr, size);
+
+	if (!ret)
+		return -1;
+
+	w->size = 0;
+
+	return 0;
+}
+
+/* Returns 1 if a window maps any of size bytes of the storage file fd at offset */
+int mm_window_mapped(int fd, uint64_t offset, uint64_t size) {
+	struct mm_window *w;
+
+	for (w = _mm_window; w < &_mm_window[MM_WINDOW_MAX]; w++) {
+		if (w->size && (w->fd == fd) && (offset < (w->offset + w->size)) && ((offset + size) > w->offset))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Write back the stores to a range of a window */
+int mm_window_sync(leg_addr_t addr, size_t size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) mm_ptr(addr) & ~(page - 1);
+	struct mm_window *w;
+
+	if (!(w = _mm_window_lookup(addr, size)) || !w->size)
+		return -1;
+
+	return msync((void *) start, (uintptr_t) mm_ptr(addr) + size - start, MS_SYNC);
+}
@@ -0,0 +1,308 @@
+/*
+   Copyright 2012-2014 Pedro A. Hortas (pah@ucodev.org)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "archdefs.h"
+#include "overlay.h"
+#include "io.h"
+
+struct overlay overlay[HW_STOR_MAX];
+
+static int _overlay_test(struct overlay *ov, uint64_t block) {
+	return ((block / 8) < ov->map_size) && (ov->map[block / 8] & (1 << (block % 8)));
+}
+
+/* Set the bits of blocks first to last, saving the map bytes holding them */
+static int _overlay_set(struct overlay *ov, uint64_t first, uint64_t last) {
+	uint64_t size = last / 8 + 1, block;
+	uint8_t *map;
+
+	if (size > ov->map_size) {
+		if (!(map = realloc(ov->map, size)))
+			return -1;
+
+		memset(map + ov->map_size, 0, size - ov->map_size);
+
+		ov->map = map;
+		ov->map_size = size;
+	}
+
+	for (block = first; block <= last; block++)
+		ov->map[block / 8] |= 1 << (block % 8);
+
+	size = last / 8 - first / 8 + 1;
+
+	if (pwrite64(ov->fdmap, &ov->map[first / 8], size, sizeof(struct overlay_header) + first / 8) != size)
+		return -1;
+
+	return 0;
+}
+
+/* Bytes visible through the overlay */
+static uint64_t _overlay_size(struct overlay *ov) {
+	return ov->size > ov->base_size ? ov->size : ov->base_size;
+}
+
+/* Read from the base image. Past its end, storage reads as zeros. */
+static ssize_t _overlay_read_base(struct overlay *ov, uint8_t *buf, size_t size, uint64_t offset) {
+	ssize_t ret = 0;
+
+	if ((offset < ov->base_size) && ((ret = pread64(ov->fdbase, buf, (ov->base_size - offset) < size ? ov->base_size - offset : size, offset)) < 0))
+		return -1;
+
+	memset(buf + ret, 0, size - ret);
+
+	return size;
+}
+
+/* Copy the block from the base image to the overlay */
+static int _overlay_copyup_block(uint16_t storid, uint64_t block) {
+	struct overlay *ov = &overlay[storid];
+	uint64_t offset = block * ov->block;
+	size_t size = ov->block;
+	uint8_t *buf;
+
+	/* The last block stops where storage does */
+	if ((offset + size) > _overlay_size(ov))
+		size = _overlay_size(ov) > offset ? _overlay_size(ov) - offset : 0;
+
+	if (!(buf = malloc(ov->block)))
+		return -1;
+
+	if ((_overlay_read_base(ov, buf, size, offset) < 0) || (pwrite64(io.fdstor[storid], buf, size, offset) != size)) {
+		free(buf);
+		return -1;
+	}
+
+	free(buf);
+
+	if ((offset + size) > ov->size)
+		ov->size = offset + size;
+
+	return _overlay_set(ov, block, block);
+}
+
+static int _overlay_init_map(struct overlay *ov) {
+	struct overlay_header hdr;
+	struct stat st;
+	ssize_t ret;
+
+	if (fstat(ov->fdmap, &st) < 0)
+		return -1;
+
+	/* New maps are created on the first run */
+	if (!st.st_size) {
+		hdr.magic = htonl(OVERLAY_MAGIC);
+		hdr.version = htonl(OVERLAY_VERSION);
+		hdr.block_size = htonl(OVERLAY_BLOCK_SIZE);
+		hdr.reserved = 0;
+
+		if (pwrite64(ov->fdmap, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			return -1;
+
+		st.st_size = sizeof(hdr);
+	}
+
+	if (pread64(ov->fdmap, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		return -1;
+
+	if ((ntohl(hdr.magic) != OVERLAY_MAGIC) || (ntohl(hdr.version) != OVERLAY_VERSION) || !(ov->block = ntohl(hdr.block_size))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Room for at least one byte, so active overlays have a map */
+	ov->map_size = st.st_size - sizeof(hdr);
+
+	if (!(ov->map = calloc(ov->map_size + 1, 1)))
+		return -1;
+
+	if ((ret = pread64(ov->fdmap, ov->map, ov->map_size, sizeof(hdr))) != ov->map_size) {
+		free(ov->map);
+		ov->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Open the base image and map of the storage at path, if it is an overlay.
+ * Returns 1 if it is, 0 if it isn't and -1 on error.
+ */
+int overlay_init(uint16_t storid, const char *path) {
+	struct overlay *ov = &overlay[storid];
+	char tmp_path[PATH_MAX];
+	struct stat st;
+	size_t len;
+
+	ov->fdbase = ov->fdmap = -1;
+
+	/* <storage dir>/NNstorage shares its prefix with NNbase and NNmap */
+	if (((len = strlen(path)) < 7) || strcmp(path + len - 7, "storage"))
+		return 0;
+
+	snprintf(tmp_path, sizeof(tmp_path) - 1, "%.*s" OVERLAY_BASE, (int) (len - 7), path);
+
+	if ((ov->fdbase = open(tmp_path, O_RDONLY)) < 0)
+		return (errno == ENOENT) ? 0 : -1;
+
+	if ((fstat(ov->fdbase, &st) < 0))
+		goto _fail;
+
+	ov->base_size = st.st_size;
+
+	if (fstat(io.fdstor[storid], &st) < 0)
+		goto _fail;
+
+	ov->size = st.st_size;
+
+	snprintf(tmp_path, sizeof(tmp_path) - 1, "%.*s" OVERLAY_MAP, (int) (len - 7), path);
+
+	if ((ov->fdmap = open(tmp_path, O_RDWR | O_CREAT, 0644)) < 0)
+		goto _fail;
+
+	if (_overlay_init_map(ov) < 0)
+		goto _fail;
+
+	return 1;
+
+_fail:
+	if (ov->fdmap >= 0)
+		close(ov->fdmap);
+
+	close(ov->fdbase);
+
+	ov->fdbase = ov->fdmap = -1;
+
+	return -1;
+}
+
+/* Same semantics as pread() */
+ssize_t overlay_read(uint16_t storid, void *buf, size_t size, uint64_t offset) {
+	struct overlay *ov = &overlay[storid];
+	uint64_t pos, end;
+	size_t done = 0, len;
+	ssize_t ret;
+	int held;
+
+	if (offset >= _overlay_size(ov))
+		return 0;
+
+	if ((offset + size) > _overlay_size(ov))
+		size = _overlay_size(ov) - offset;
+
+	while (done < size) {
+		pos = offset + done;
+		held = _overlay_test(ov, pos / ov->block);
+
+		/* Read runs of blocks held by the same layer at once */
+		for (end = (pos / ov->block + 1) * ov->block; (end < (offset + size)) && (_overlay_test(ov, end / ov->block) == held); end += ov->block);
+
+		len = ((end < (offset + size)) ? end : (offset + size)) - pos;
+
+		if (held) {
+			if ((ret = pread64(io.fdstor[storid], (uint8_t *) buf + done, len, pos)) < 0)
+				return done ? done : -1;
+
+			memset((uint8_t *) buf + done + ret, 0, len - ret);
+		} else if (_overlay_read_base(ov, (uint8_t *) buf + done, len, pos) < 0) {
+			return done ? done : -1;
+		}
+
+		done += len;
+	}
+
+	return done;
+}
+
+/* Same semantics as pwrite(). Blocks partially written are copied up from
+ * the base image first.
+ */
+ssize_t overlay_write(uint16_t storid, const void *buf, size_t size, uint64_t offset) {
+	struct overlay *ov = &overlay[storid];
+	uint64_t first = offset / ov->block, last = (offset + size - 1) / ov->block;
+
+	if (!size)
+		return 0;
+
+	if (!_overlay_test(ov, first) && (offset % ov->block) && (_overlay_copyup_block(storid, first) < 0))
+		return -1;
+
+	if (!_overlay_test(ov, last) && ((offset + size) % ov->block) && ((offset + size) < _overlay_size(ov)) && (_overlay_copyup_block(storid, last) < 0))
+		return -1;
+
+	if (pwrite64(io.fdstor[storid], buf, size, offset) != size)
+		return -1;
+
+	if ((offset + size) > ov->size)
+		ov->size = offset + size;
+
+	/* Blocks are marked held once their data is written */
+	if (_overlay_set(ov, first, last) < 0)
+		return -1;
+
+	return size;
+}
+
+/* Copy the blocks of a range held by the base image to the overlay, so the
+ * overlay file can be accessed directly.
+ */
+int overlay_copyup(uint16_t storid, uint64_t offset, size_t size) {
+	struct overlay *ov = &overlay[storid];
+	uint64_t block;
+
+	if (!overlay_active(storid) || !size)
+		return 0;
+
+	/* Windows can't reach past the end of storage */
+	if ((offset + size) > _overlay_size(ov))
+		return -1;
+
+	for (block = offset / ov->block; block <= (offset + size - 1) / ov->block; block++) {
+		if (!_overlay_test(ov, block) && (_overlay_copyup_block(storid, block) < 0))
+			return -1;
+	}
+
+	return 0;
+}
+
+void overlay_destroy(void) {
+	struct overlay *ov;
+
+	for (ov = overlay; ov < &overlay[HW_STOR_MAX]; ov++) {
+		if (!ov->map)
+			continue;
+
+		close(ov->fdmap);
+		close(ov->fdbase);
+		free(ov->map);
+
+		memset(ov, 0, sizeof(*ov));
+	}
+}
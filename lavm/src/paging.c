@@ -16,25 +16,73 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <stddef.h>
 
 #include <arpa/inet.h>
 
 #include "archdefs.h"
+#include "config.h"
 #include "paging.h"
+#include "decode.h"
 #include "mm.h"
 #include "register.h"
 #include "fault.h"
 
-struct page *paging_get_laddr_page(leg_addr_t laddr) {
+struct paging_tlb tlb;
+struct paging_map pmap;
+
+/* Page entries must be tracked so guest writes to them reach
+ * paging_tlb_write(). They share the code block map of the decode cache.
+ */
+static void _paging_tlb_track(leg_addr_t addr, leg_addr_t size) {
+	uint64_t blk, end = (uint64_t) addr + size;
+
+	if (end > config.vm.ram)
+		return;
+
+	decode_track(addr, size);
+
+	for (blk = addr >> DECODE_BLOCK_SHIFT; blk <= ((end - 1) >> DECODE_BLOCK_SHIFT); blk++)
+		tlb.map[blk >> 3] |= 1 << (blk & 7);
+}
+
+/* Walk the page list from RPA. On a match, [*start, *end] is set to the
+ * logical range around laddr where pg is also the first match.
+ */
+static struct page *_paging_walk(leg_addr_t laddr, leg_addr_t *start, leg_addr_t *end, int track) {
 	struct page *pg;
+	leg_addr_t pg_start, pg_end;
 
 	/* Get first page from RPA  */
 	pg = (struct page *) (((char *) mm) + htonl(regs.rpa));
 
 	do {
-		if ((laddr >= ntohl(pg->laddr)) && (laddr <= (ntohl(pg->laddr) + ntohl(pg->size))))
+		pg_start = ntohl(pg->laddr);
+		pg_end = ntohl(pg->laddr) + ntohl(pg->size);
+
+		if (track)
+			_paging_tlb_track((char *) pg - (char *) mm, sizeof(struct page));
+
+		if ((laddr >= pg_start) && (laddr <= pg_end)) {
+			if (pg_start > *start)
+				*start = pg_start;
+
+			if (pg_end < *end)
+				*end = pg_end;
+
 			return pg;
+		}
+
+		/* Earlier pages take precedence where they overlap */
+		if (pg_start <= pg_end) {
+			if ((pg_end < laddr) && (pg_end >= *start))
+				*start = pg_end + 1;
+			else if ((pg_start > laddr) && (pg_start <= *end))
+				*end = pg_start - 1;
+		}
 
 		pg = (struct page *) (((char *) mm) + ntohl(pg->next));
 	} while (pg);
@@ -42,10 +90,422 @@ struct page *paging_get_laddr_page(leg_addr_t laddr) {
 	return NULL;
 }
 
-leg_addr_t paging_get_paddr(leg_addr_t laddr, leg_addr_t flags) {
+struct page *paging_get_laddr_page(leg_addr_t laddr) {
+	leg_addr_t start = 0, end = ~0;
+
+	return _paging_walk(laddr, &start, &end, 0);
+}
+
+static int _paging_index_ref_cmp(const void *a, const void *b) {
+	const struct paging_index_ref *x = a, *y = b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static int _paging_index_bound_cmp(const void *a, const void *b) {
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/* Min-heap of page list positions, so the first page in list order covering
+ * an address is always on top.
+ */
+static void _paging_index_heap_push(uint32_t *heap, uint32_t *len, uint32_t page) {
+	uint32_t i = (*len)++, parent;
+
+	for (; i && (heap[parent = (i - 1) / 2] > page); i = parent)
+		heap[i] = heap[parent];
+
+	heap[i] = page;
+}
+
+static void _paging_index_heap_pop(uint32_t *heap, uint32_t *len) {
+	uint32_t i = 0, child, last = heap[--(*len)];
+
+	while ((child = 2 * i + 1) < *len) {
+		if (((child + 1) < *len) && (heap[child + 1] < heap[child]))
+			child++;
+
+		if (heap[child] >= last)
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = last;
+}
+
+/* Split the logical address space into disjoint ranges, each resolved to the
+ * first page of the list covering it, as a walk would.
+ */
+static int _paging_index_ranges(struct paging_index *idx) {
+	struct paging_index_page *pi;
+	struct paging_index_range *r = NULL;
+	struct paging_index_ref *start;
+	uint64_t *bound, x;
+	uint32_t *heap, len = 0, n = 0, nb = 0, i, j, k;
+
+	idx->ranges = 0;
+	idx->dirty = 0;
+
+	if (!idx->count)
+		return 0;
+
+	start = malloc(idx->count * sizeof(struct paging_index_ref));
+	bound = malloc(idx->count * 2 * sizeof(uint64_t));
+	heap = malloc(idx->count * sizeof(uint32_t));
+
+	if (!start || !bound || !heap) {
+		free(start);
+		free(bound);
+		free(heap);
+		return -1;
+	}
+
+	for (i = 0; i < idx->count; i++) {
+		pi = &idx->page[i];
+
+		/* Pages wrapping around the address space never match */
+		if ((leg_addr_t) (pi->laddr + pi->size) < pi->laddr)
+			continue;
+
+		start[n].key = pi->laddr;
+		start[n++].page = i;
+
+		bound[nb++] = pi->laddr;
+		bound[nb++] = (uint64_t) (leg_addr_t) (pi->laddr + pi->size) + 1;
+	}
+
+	qsort(start, n, sizeof(struct paging_index_ref), _paging_index_ref_cmp);
+	qsort(bound, nb, sizeof(uint64_t), _paging_index_bound_cmp);
+
+	for (k = 0, j = 0; k < nb; k = i) {
+		x = bound[k];
+
+		/* Next distinct bound */
+		for (i = k + 1; (i < nb) && (bound[i] == x); i++);
+
+		while ((j < n) && (start[j].key == x))
+			_paging_index_heap_push(heap, &len, start[j++].page);
+
+		while (len && ((uint64_t) (leg_addr_t) (idx->page[heap[0]].laddr + idx->page[heap[0]].size) < x))
+			_paging_index_heap_pop(heap, &len);
+
+		if (!len || (i >= nb))
+			continue;
+
+		if (r && (r->page == heap[0]) && (((uint64_t) r->end + 1) == x)) {
+			r->end = bound[i] - 1;
+			continue;
+		}
+
+		r = &idx->range[idx->ranges++];
+		r->start = x;
+		r->end = bound[i] - 1;
+		r->page = heap[0];
+	}
+
+	free(start);
+	free(bound);
+	free(heap);
+
+	return 0;
+}
+
+static int _paging_index_next(leg_addr_t addr, leg_addr_t *next) {
+	if (((uint64_t) addr + sizeof(struct page)) > config.vm.ram)
+		return -1;
+
+	*next = mm_load_addr(addr + offsetof(struct page, next));
+
+	return 0;
+}
+
+static void _paging_index_drop(struct paging_index *idx) {
+	free(idx->page);
+	free(idx->byaddr);
+	free(idx->range);
+
+	memset(idx, 0, sizeof(struct paging_index));
+}
+
+/* Read the page list at rpa. Lists with entries outside RAM, or too long to
+ * index, are left empty so they keep being walked.
+ */
+static int _paging_index_build(struct paging_index *idx, leg_addr_t rpa) {
+	struct page *pg;
+	leg_addr_t head = htonl(rpa), tortoise = head, hare, addr;
+	uint32_t power = 1, lam = 1, mu = 0, i;
+
+	idx->rpa = rpa;
+	idx->valid = 1;
+
+	/* A list never ends, as a null next refers to the entry at address 0.
+	 * Find where it loops back (Brent's algorithm).
+	 */
+	if (_paging_index_next(head, &hare) < 0)
+		return 0;
+
+	while (tortoise != hare) {
+		if (power == lam) {
+			tortoise = hare;
+			power <<= 1;
+			lam = 0;
+		}
+
+		if ((power > PAGING_INDEX_PAGES_MAX) || (_paging_index_next(hare, &hare) < 0))
+			return 0;
+
+		lam++;
+	}
+
+	/* Every entry below was already visited above */
+	for (tortoise = hare = head, i = 0; i < lam; i++)
+		_paging_index_next(hare, &hare);
+
+	for (; tortoise != hare; mu++) {
+		_paging_index_next(tortoise, &tortoise);
+		_paging_index_next(hare, &hare);
+	}
+
+	if ((mu + lam) > PAGING_INDEX_PAGES_MAX)
+		return 0;
+
+	idx->page = malloc((mu + lam) * sizeof(struct paging_index_page));
+	idx->byaddr = malloc((mu + lam) * sizeof(struct paging_index_ref));
+	idx->range = malloc((mu + lam) * 2 * sizeof(struct paging_index_range));
+
+	if (!idx->page || !idx->byaddr || !idx->range) {
+		_paging_index_drop(idx);
+		return -1;
+	}
+
+	for (addr = head; idx->count < (mu + lam); idx->count++) {
+		pg = (struct page *) (((char *) mm) + addr);
+
+		idx->page[idx->count].addr = addr;
+		idx->page[idx->count].laddr = ntohl(pg->laddr);
+		idx->page[idx->count].paddr = ntohl(pg->paddr);
+		idx->page[idx->count].size = ntohl(pg->size);
+		idx->page[idx->count].flags = ntohl(pg->flags);
+		idx->page[idx->count].next = ntohl(pg->next);
+
+		idx->byaddr[idx->count].key = addr;
+		idx->byaddr[idx->count].page = idx->count;
+
+		_paging_tlb_track(addr, sizeof(struct page));
+
+		addr = idx->page[idx->count].next;
+	}
+
+	qsort(idx->byaddr, idx->count, sizeof(struct paging_index_ref), _paging_index_ref_cmp);
+
+	if (_paging_index_ranges(idx) < 0) {
+		_paging_index_drop(idx);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Get the index of the current page list, building it on first use */
+static struct paging_index *_paging_index_get(void) {
+	struct paging_index *idx;
+
+	for (idx = pmap.index; idx < &pmap.index[PAGING_INDEX_MAX]; idx++) {
+		if (!idx->valid || (idx->rpa != regs.rpa))
+			continue;
+
+		if (idx->dirty && (_paging_index_ranges(idx) < 0)) {
+			_paging_index_drop(idx);
+			return NULL;
+		}
+
+		return idx;
+	}
+
+	idx = &pmap.index[pmap.victim];
+	pmap.victim = (pmap.victim + 1) % PAGING_INDEX_MAX;
+
+	_paging_index_drop(idx);
+
+	if (_paging_index_build(idx, regs.rpa) < 0)
+		return NULL;
+
+	return idx;
+}
+
+static struct paging_index_range *_paging_index_find(struct paging_index *idx, leg_addr_t laddr) {
+	uint32_t lo = 0, hi = idx->ranges, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (idx->range[mid].start <= laddr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo || (laddr > idx->range[lo - 1].end))
+		return NULL;
+
+	return &idx->range[lo - 1];
+}
+
+/* Reread the entry of page i from guest memory. Returns 1 if it changed, or
+ * -1 if the list itself changed and the index was dropped.
+ */
+static int _paging_index_refresh(struct paging_index *idx, uint32_t i) {
+	struct paging_index_page *pi = &idx->page[i];
+	struct page *pg = (struct page *) (((char *) mm) + pi->addr);
+	int changed = 0;
+
+	if (ntohl(pg->next) != pi->next) {
+		_paging_index_drop(idx);
+		return -1;
+	}
+
+	/* Writes may have cleared the tracking of the entry */
+	_paging_tlb_track(pi->addr, sizeof(struct page));
+
+	if ((ntohl(pg->laddr) != pi->laddr) || (ntohl(pg->size) != pi->size)) {
+		pi->laddr = ntohl(pg->laddr);
+		pi->size = ntohl(pg->size);
+		idx->dirty = 1;
+		changed = 1;
+	}
+
+	if ((ntohl(pg->paddr) != pi->paddr) || (ntohl(pg->flags) != pi->flags)) {
+		pi->paddr = ntohl(pg->paddr);
+		pi->flags = ntohl(pg->flags);
+		changed = 1;
+	}
+
+	return changed;
+}
+
+/* Reread the entries overlapping the written range */
+static void _paging_index_write(struct paging_index *idx, leg_addr_t addr, leg_addr_t size) {
+	uint64_t end = (uint64_t) addr + size;
+	leg_addr_t lower = addr >= sizeof(struct page) ? addr - sizeof(struct page) + 1 : 0;
+	uint32_t lo = 0, hi = idx->count, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (idx->byaddr[mid].key < lower)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; (lo < idx->count) && (idx->byaddr[lo].key < end); lo++) {
+		if (_paging_index_refresh(idx, idx->byaddr[lo].page) < 0)
+			return;
+	}
+}
+
+static void _paging_tlb_fill(leg_addr_t base, leg_addr_t mask, leg_addr_t paddr, leg_addr_t flags, leg_addr_t start, leg_addr_t end) {
+	leg_addr_t set = (start == end ? start >> PAGING_TLB_WORD_SHIFT : start >> PAGING_TLB_SHIFT) & (PAGING_TLB_SETS - 1);
+	struct paging_tlb_entry *e = &tlb.entry[set][tlb.victim[set]];
+
+	tlb.victim[set] = (tlb.victim[set] + 1) % PAGING_TLB_WAYS;
+
+	if (!e->valid)
+		tlb.count++;
+
+	e->rpa = regs.rpa;
+	e->format = regs.rst & REG_RST_BIT_RADIX;
+	e->start = start;
+	e->end = end;
+	e->base = base;
+	e->mask = mask;
+	e->paddr = paddr;
+	e->flags = flags;
+	e->valid = 1;
+}
+
+static void _paging_tlb_clear(void) {
+	memset(tlb.entry, 0, sizeof(tlb.entry));
+
+	tlb.count = 0;
+}
+
+/* Read the radix entry at addr, faulting if it isn't present */
+static int _paging_radix_entry(leg_addr_t addr, leg_addr_t laddr, leg_addr_t *entry) {
+	if (((uint64_t) addr + sizeof(leg_addr_t)) > config.vm.ram) {
+		fault_bad_mm(addr);
+		return -1;
+	}
+
+	_paging_tlb_track(addr, sizeof(leg_addr_t));
+
+	*entry = mm_load_addr(addr);
+
+	if (!(*entry & PAGE_RADIX_PRESENT)) {
+		fault_no_page(laddr);
+		return -1;
+	}
+
+	return 0;
+}
+
+static leg_addr_t _paging_radix_get_paddr(leg_addr_t laddr, leg_addr_t flags) {
+	leg_addr_t dir, pte, frame, start = laddr & PAGING_RADIX_FRAME_MASK;
+
+	if (_paging_radix_entry((regs.rpa & PAGING_RADIX_FRAME_MASK) + ((laddr >> (PAGING_RADIX_SHIFT + PAGING_RADIX_BITS)) << 2), laddr, &dir) < 0)
+		return 0;
+
+	if (_paging_radix_entry((dir & PAGING_RADIX_FRAME_MASK) + (((laddr >> PAGING_RADIX_SHIFT) & (PAGING_RADIX_ENTRIES - 1)) << 2), laddr, &pte) < 0)
+		return 0;
+
+	/* Check page flags */
+	if (!(pte & flags)) {
+		fault_page_perm(laddr, flags);
+		return 0;
+	}
+
+	frame = pte & PAGING_RADIX_FRAME_MASK;
+
+	_paging_tlb_fill(frame - start, 0, frame, pte & (PAGE_PERM_RO | PAGE_PERM_RW | PAGE_PERM_EXEC), start, start + (PAGING_RADIX_PAGE_SIZE - 1));
+
+	return frame | (laddr & ~PAGING_RADIX_FRAME_MASK);
+}
+
+leg_addr_t paging_get_paddr_slow(leg_addr_t laddr, leg_addr_t flags) {
+	struct paging_index *idx;
+	struct paging_index_range *r;
+	struct paging_index_page *pi;
 	struct page *pg;
+	leg_addr_t start, end;
+
+	if (regs.rst & REG_RST_BIT_RADIX)
+		return _paging_radix_get_paddr(laddr, flags);
+
+	/* Entries never cross the 4KiB block they are indexed by */
+	start = laddr & ~((1 << PAGING_TLB_SHIFT) - 1);
+	end = start + ((1 << PAGING_TLB_SHIFT) - 1);
+
+	/* Lists that can't be indexed, or with no page covering laddr, are
+	 * walked as before.
+	 */
+	if ((idx = _paging_index_get()) && (r = _paging_index_find(idx, laddr))) {
+		pi = &idx->page[r->page];
+
+		if (!(pi->flags & flags)) {
+			fault_page_perm(laddr, flags);
+			return 0;
+		}
+
+		_paging_tlb_fill(pi->paddr + pi->laddr + 1, ~0, pi->paddr, pi->flags, r->start > start ? r->start : start, r->end < end ? r->end : end);
 
-	if (!(pg = paging_get_laddr_page(laddr))) {
+		return pi->paddr + (pi->laddr - laddr);
+	}
+
+	if (!(pg = _paging_walk(laddr, &start, &end, 1))) {
 	        /* If the page isn't found, generate a
 		 * page fault
 		 */
@@ -60,7 +520,92 @@ leg_addr_t paging_get_paddr(leg_addr_t laddr, leg_addr_t flags) {
 		return 0;
 	}
 
+	_paging_tlb_fill(ntohl(pg->paddr) + ntohl(pg->laddr) + 1, ~0, ntohl(pg->paddr), ntohl(pg->flags), start, end);
+
 	/* Set physical RIP */
 	return paging_translate_laddr(pg, laddr);
 }
 
+/* Drop the translations to the page at physical base address paddr, and
+ * reread the indexed entries of that page.
+ */
+void paging_tlb_invalidate(leg_addr_t paddr) {
+	struct paging_index *idx;
+	int set, way, changed = 0;
+	uint32_t i;
+
+	for (set = 0; set < PAGING_TLB_SETS; set++) {
+		for (way = 0; way < PAGING_TLB_WAYS; way++) {
+			if (tlb.entry[set][way].valid && (tlb.entry[set][way].paddr == paddr)) {
+				tlb.entry[set][way].valid = 0;
+				tlb.count--;
+			}
+		}
+	}
+
+	for (idx = pmap.index; idx < &pmap.index[PAGING_INDEX_MAX]; idx++) {
+		for (i = 0; idx->valid && (i < idx->count); i++) {
+			if ((idx->page[i].paddr == paddr) && _paging_index_refresh(idx, i))
+				changed = 1;
+		}
+	}
+
+	/* Cached ranges depend on every entry */
+	if (changed)
+		_paging_tlb_clear();
+}
+
+/* Must be called whenever guest memory in range is written. Translations
+ * depend on every page entry walked to fill them, so any write to one of
+ * them flushes the whole TLB. Indexed entries are reread.
+ */
+void paging_tlb_write(leg_addr_t addr, leg_addr_t size) {
+	struct paging_index *idx;
+	uint64_t blk;
+
+	for (blk = addr >> DECODE_BLOCK_SHIFT; blk <= (((uint64_t) addr + size - 1) >> DECODE_BLOCK_SHIFT); blk++) {
+		if ((blk < tlb.map_blocks) && (tlb.map[blk >> 3] & (1 << (blk & 7)))) {
+			for (idx = pmap.index; idx < &pmap.index[PAGING_INDEX_MAX]; idx++) {
+				if (idx->valid)
+					_paging_index_write(idx, addr, size);
+			}
+
+			_paging_tlb_clear();
+
+			return;
+		}
+	}
+}
+
+void paging_tlb_flush(void) {
+	int i;
+
+	for (i = 0; i < PAGING_INDEX_MAX; i++)
+		_paging_index_drop(&pmap.index[i]);
+
+	_paging_tlb_clear();
+
+	memset(tlb.map, 0, (tlb.map_blocks + 7) >> 3);
+}
+
+int paging_init(void) {
+	tlb.map_blocks = (config.vm.ram >> DECODE_BLOCK_SHIFT) + 2;
+
+	if (!(tlb.map = malloc((tlb.map_blocks + 7) >> 3)))
+		return -1;
+
+	memset(&pmap, 0, sizeof(pmap));
+
+	paging_tlb_flush();
+
+	return 0;
+}
+
+void paging_destroy(void) {
+	int i;
+
+	for (i = 0; i < PAGING_INDEX_MAX; i++)
+		_paging_index_drop(&pmap.index[i]);
+
+	free(tlb.map);
+}
@@ -19,6 +19,7 @@
 
 #include "archdefs.h"
 #include "register.h"
+#include "alu.h"
 #include "fault.h"
 
 
@@ -37,6 +38,9 @@ volatile leg_addr_t *const regs_list[REG_NUM] = {
 };
 
 volatile void *register_decode(leg_addr_t regid) {
+	if (regid == REG_RARTH)
+		alu_flags_sync();
+
 	return regs_list[regid / 4];
 }
 
@@ -67,6 +71,10 @@ int register_grant_rfp(leg_addr_t regid) {
 	return 1;
 }
 
+int register_is_valid(leg_addr_t regid) {
+	return ((regid <= REG_RFP4) && !(regid % 4));
+}
+
 int register_is_rfp(leg_addr_t regid) {
 	return ((regid >= REG_RFP1) && (regid <= REG_RFP4));
 }
@@ -30,90 +30,227 @@
 #include "config.h"
 #include "debug.h"
 #include "paging.h"
+#include "decode.h"
+#include "jit.h"
 
 volatile struct run run;
 
-void run_start(void) {
+/* Process the instruction at regs.rip. Returns -1 if it must be restarted
+ * before hardware interrupts are checked.
+ */
+static inline int _run_step(int mode) {
 	leg_addr_t prip;	// physical RIP
-	leg_addr_t opcode_oper1, opcode_oper2;
-	uint8_t opcode_size, opcode_id, operand1_type, operand2_type;
+	struct decode *d;
 
-	for (;;) {
-		opcode_size = 0;
-		opcode_id = 0;
-		opcode_oper1 = 0;
-		opcode_oper2 = 0;
+	/* Always assume regs.rip is in the physical address space
+	 * If it isn't, the next condition compound will translate it.
+	 */
+	prip = regs.rip;
 
-		/* Assume operand types as register by default */
-		operand1_type = OPERAND_TYPE_REG;
-		operand2_type = OPERAND_TYPE_REG;
+	/* If paging is being used, translate logical address to
+	 * physical address
+	 */
+	if (mode & INSTRUCTION_MODE_PAGING) {
+		/* Get physical address and grant page is executable */
+		if (!(prip = paging_get_paddr(regs.rip, PAGE_PERM_EXEC)))
+			return -1;
+	}
 
-		/* Always assume regs.rip is in the physical address space
-		 * If it isn't, the next condition compound will translate it.
-		 */
-		prip = regs.rip;
+	/* Use the decoded instruction if cached, otherwise fetch and
+	 * decode it from memory.
+	 */
+	if ((d = decode_lookup(prip))) {
+		run.opcode = d->opcode;
+	} else if (!(d = decode_fetch(prip))) {
+		return -1;
+	}
 
-		/* If paging is being used, translate logical address to
-		 * physical address
-		 */
-		if (regs.rst & REG_RST_BIT_PAGING) {
-			/* Get physical address and grant page is executable */
-			if (!(prip = paging_get_paddr(regs.rip, PAGE_PERM_EXEC)))
-				continue;
-		}
+	run.icount++;
+
+	/* Process instruction, or the superinstruction it starts */
+	if (d->fused)
+		instruction_fused[mode][d->fused](d);
+	else
+		instruction_dispatch[mode][d->variant](d->oper1, d->oper2, d->size, d->oper1_type, d->oper2_type);
+
+	return 0;
+}
 
-		/* Sanity check - Check normal zone and RAM boundaries */
-		if (!mm_grant_zone_normal(prip))
+static void _run_table(void) {
+	for (;;) {
+		/* Select the dispatch table for the current RST mode bits */
+		if (_run_step(instruction_mode(regs.rst)) < 0)
 			continue;
 
-		/* Extract opcode */
-		run.opcode = ntohl(*((uint32_t *) &((char *) mm)[prip]));
+		/* Check for hardware interrupts */
+		interrupt_hw_check();
+	}
+}
 
-		/* Extract instruction id and respective operands */
-		opcode_size += ARCH_ADDR_BITS >> 3;
-		opcode_id = run.opcode & 0xFF;
-		opcode_oper1 = (run.opcode & 0xFF00) >> 8;
-		opcode_oper2 = (run.opcode & 0xFF0000) >> 16;
+#if RUN_JIT
+static void _run_jit(void) {
+	struct jit_block *b;
+	int mode;
 
-		/* Another sanity check */
-		if (!opcode_id || (opcode_id >= INSTRUCTION_SET_SIZE)) {
-			fault_illegal_instruction();
-			continue;
-		}
+	for (;;) {
+		mode = instruction_mode(regs.rst);
 
-		/* Evaluate the opcode structure and properly
-		 * set the operands
+		/* Blocks are only built with paging disabled, where RIP is
+		 * a physical address. Cold code is interpreted.
 		 */
-		if (!opcode_oper2 && (instruction[opcode_id - 1].size > 1)) {
-			/* Check if we're not out of RAM bondaries */
-			if (!mm_grant_zone_normal(prip + (ARCH_ADDR_BITS >> (3 - !opcode_oper1))))
+		if ((mode & INSTRUCTION_MODE_PAGING) || !(b = jit_lookup(regs.rip, mode))) {
+			if (_run_step(mode) < 0)
 				continue;
+		} else {
+			jit.dirty = 0;
 
-			opcode_oper2 = ntohl(*((leg_addr_t *) &((char *) mm)[prip + (ARCH_ADDR_BITS >> (3 - !opcode_oper1))]));
+			/* Interrupts may have been checked on the block exit */
+			if (b->code())
+				continue;
+		}
 
-			opcode_size += (ARCH_ADDR_BITS >> 3);
+		/* Check for hardware interrupts */
+		interrupt_hw_check();
+	}
+}
+#endif
 
-			operand2_type = OPERAND_TYPE_LIT;
-		}
+#if RUN_THREADED
+/* Dispatch the instruction at regs.rip. Each handler expands its own copy,
+ * so the host predicts every indirect jump from the previous instruction.
+ */
+#define RUN_THREADED_DISPATCH() do { \
+	prip = regs.rip; \
+	mode = instruction_mode(regs.rst); \
+	if (mode & INSTRUCTION_MODE_PAGING) { \
+		if (!(prip = paging_get_paddr(regs.rip, PAGE_PERM_EXEC))) \
+			goto _restart; \
+	} \
+	if (!(d = decode_lookup(prip)) || !d->thread) \
+		goto _miss; \
+	run.opcode = d->opcode; \
+	run.icount++; \
+	goto *d->thread; \
+} while (0)
 
-		if (!opcode_oper1 && (instruction[opcode_id - 1].size > 0)) {
-			/* Check if we're not out of RAM bondaries */
+/* Process instruction through its decoded handler variant for the current
+ * mode, check for hardware interrupts and dispatch next
+ */
+#define RUN_THREADED_OP(op) _##op: \
+	instruction_dispatch[mode][d->variant](d->oper1, d->oper2, d->size, d->oper1_type, d->oper2_type); \
+	if (regs.rst & REG_RST_BIT_INTR) \
+		interrupt_hw_check(); \
+	RUN_THREADED_DISPATCH();
 
-			if (!mm_grant_zone_normal(prip + (ARCH_ADDR_BITS >> 3)))
-				continue;
+static void _run_threaded(void) {
+	static const void *dispatch[INSTRUCTION_SET_SIZE] = {
+		&&_restart,
+		&&_cpvr, &&_cpvl, &&_cpr, &&_cprr, &&_cmp, &&_jmp, &&_call,
+		&&_ret, &&_arth, &&_lgic, &&_intr, &&_ceb, &&_nop
+	};
+	leg_addr_t prip;	// physical RIP
+	struct decode *d;
+	int mode;
 
-			opcode_oper1 = ntohl(*((leg_addr_t *) &((char *) mm)[prip + (ARCH_ADDR_BITS >> 3)]));
+_restart:
+	RUN_THREADED_DISPATCH();
 
-			opcode_size += (ARCH_ADDR_BITS >> 3);
+_miss:
+	/* Fetch and decode the instruction, unless it was decoded ahead of
+	 * time, then bind it to its handler
+	 */
+	if ((d = decode_lookup(prip)))
+		run.opcode = d->opcode;
+	else if (!(d = decode_fetch(prip)))
+		goto _restart;
 
-			operand1_type = OPERAND_TYPE_LIT;
-		}
+	d->thread = d->fused ? &&_fused : dispatch[d->id];
 
-		/* Process instruction */
-		instruction[opcode_id - 1].doop(opcode_oper1, opcode_oper2, opcode_size, operand1_type, operand2_type);
+	run.icount++;
 
-		/* Check for hardware interrupts */
+	goto *d->thread;
+
+	RUN_THREADED_OP(cpvr)
+	RUN_THREADED_OP(cpvl)
+	RUN_THREADED_OP(cpr)
+	RUN_THREADED_OP(cprr)
+	RUN_THREADED_OP(cmp)
+	RUN_THREADED_OP(jmp)
+	RUN_THREADED_OP(call)
+	RUN_THREADED_OP(ret)
+	RUN_THREADED_OP(arth)
+	RUN_THREADED_OP(lgic)
+	RUN_THREADED_OP(intr)
+	RUN_THREADED_OP(ceb)
+	RUN_THREADED_OP(nop)
+
+_fused:
+	/* Superinstructions check for interrupts between their instructions */
+	instruction_fused[mode][d->fused](d);
+	if (regs.rst & REG_RST_BIT_INTR)
 		interrupt_hw_check();
+	RUN_THREADED_DISPATCH();
+}
+#endif
+
+void run_start(void) {
+	/* Resolve the execution core */
+	run.core = config.vm.core;
+
+	if (run.core == RUN_CORE_DEFAULT)
+		run.core = RUN_THREADED ? RUN_CORE_THREADED : RUN_CORE_TABLE;
+
+	if (!RUN_THREADED && (run.core == RUN_CORE_THREADED)) {
+		puts("Threaded core not supported by this build. Using table core.");
+		run.core = RUN_CORE_TABLE;
 	}
+
+	if (!RUN_JIT && (run.core == RUN_CORE_JIT)) {
+		puts("JIT core not supported by this build. Using table core.");
+		run.core = RUN_CORE_TABLE;
+	}
+
+#if RUN_JIT
+	if ((run.core == RUN_CORE_JIT) && (jit_init() < 0)) {
+		puts("Failed to allocate JIT code cache. Using table core.");
+		run.core = RUN_CORE_TABLE;
+	}
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, (struct timespec *) &run.start);
+
+#if MM_GUARD_REGION
+	/* Guest accesses past RAM trap back here. The faulting instruction
+	 * had no effect, so raise the fault and restart the core.
+	 */
+	if (sigsetjmp(mm_guard.env, 1))
+		fault_bad_mm(mm_guard.addr);
+
+	mm_guard.thread = pthread_self();
+	mm_guard.armed = 1;
+#endif
+
+#if RUN_THREADED
+	if (run.core == RUN_CORE_THREADED)
+		_run_threaded();
+#endif
+#if RUN_JIT
+	if (run.core == RUN_CORE_JIT)
+		_run_jit();
+#endif
+	_run_table();
 }
 
+void run_stats(void) {
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	elapsed = (now.tv_sec - run.start.tv_sec) + (now.tv_nsec - run.start.tv_nsec) / 1e9;
+
+	printf("%s core: %llu instructions in %.3fs (%.2f MIPS)\n",
+		run.core == RUN_CORE_JIT ? "JIT" : run.core == RUN_CORE_THREADED ? "Threaded" : "Table",
+		(unsigned long long) run.icount, elapsed,
+		elapsed > 0 ? run.icount / elapsed / 1e6 : 0.0);
+}
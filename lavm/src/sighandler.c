@@ -16,22 +16,74 @@
 */
 
 #include <signal.h>
+#include <string.h>
+#include <ucontext.h>
+
+/* Host register names clash with the guest ones */
+#undef REG_RIP
 
 #include "sighandler.h"
 #include "fault.h"
+#include "mm.h"
 
 static void _sig_handler(int n) {
 	fault_mc();
 }
 
+static void _sig_segv_handler(int n, siginfo_t *si, void *context) {
+#if MM_DIRTY
+	/* First store to a clean chunk of tracked RAM */
+	if (mm_dirty_trap(si->si_addr))
+		return;
+#endif
+#if MM_WATCH
+	/* Stores to watched RAM are retried one host instruction at a time */
+	if (mm_watch_trap(si->si_addr)) {
+		((ucontext_t *) context)->uc_mcontext.gregs[REG_EFL] |= SIGHANDLER_EFL_TF;
+		return;
+	}
+#endif
+#if MM_GUARD_REGION
+	/* Guest accesses past RAM resume the VM with a fault raised */
+	mm_guard_trap(si->si_addr);
+#endif
+	fault_mc();
+}
+
+#if MM_WATCH
+static void _sig_trap_handler(int n, siginfo_t *si, void *context) {
+	/* The store to watched RAM is done, protect it again */
+	mm_watch_step();
+
+	((ucontext_t *) context)->uc_mcontext.gregs[REG_EFL] &= ~SIGHANDLER_EFL_TF;
+}
+#endif
+
+/* Stop the whole VM until SIGCONT is received */
+void sighandler_pause(void) {
+	raise(SIGSTOP);
+}
+
 void sighandler_init(void) {
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = &_sig_segv_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+
 	signal(SIGFPE, &_sig_handler);
 	signal(SIGTERM, &_sig_handler);
 	signal(SIGHUP, &_sig_handler);
-	signal(SIGSEGV, &_sig_handler);
+	sigaction(SIGSEGV, &sa, NULL);
 	signal(SIGILL, &_sig_handler);
 	signal(SIGINT, &_sig_handler);
 	signal(SIGQUIT, &_sig_handler);
+
+#if MM_WATCH
+	sa.sa_sigaction = &_sig_trap_handler;
+	sigaction(SIGTRAP, &sa, NULL);
+#endif
 }
 
 
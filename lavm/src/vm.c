@@ -21,14 +21,35 @@
 #include "config.h"
 #include "init.h"
 #include "mm.h"
+#include "run.h"
+#include "decode.h"
+#include "aot.h"
+#include "paging.h"
+#include "jit.h"
+#include "alu.h"
 #include "io.h"
+#include "bcache.h"
 #include "timer.h"
 #include "pqueue.h"
 
 
 void vm_destroy(void) {
+	alu_flags_sync();
+
+	run_stats();
+	mm_dirty_stats();
+	mm_share_stats();
+	mm_balloon_stats();
+	bcache_stats();
+
 	timer_destroy();
 	io_destroy();
+	decode_destroy();
+	paging_destroy();
+	aot_destroy();
+#if RUN_JIT
+	jit_destroy();
+#endif
 	mm_destroy();
 	config_destroy();
 